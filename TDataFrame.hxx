@@ -13,20 +13,44 @@
 #define ROOT_TDATAFRAME
 
 #include "TBranchElement.h"
+#include "TChain.h"
 #include "TDirectory.h"
+#include "TFile.h"
 #include "TH1F.h" // For Histo actions
+#include "TH2F.h"
+#include "TH3F.h"
+#include "TProfile.h"
+#include "TProfile2D.h"
 #include "TROOT.h" // IsImplicitMTEnabled, GetImplicitMTPoolSize
+#include "ROOT/TBufferMerger.hxx"
+#include "ROOT/TSeq.hxx"
 #include "ROOT/TSpinMutex.hxx"
-#include "ROOT/TTreeProcessorMT.hxx"
+#include "ROOT/TThreadExecutor.hxx"
 #include "TTreeReader.h"
+#include "TTreeReaderArray.h"
 #include "TTreeReaderValue.h"
 
 #include <algorithm> // std::find
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
-#include <memory>
+#include <memory> // std::align
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <type_traits> // std::decay
 #include <typeinfo>
 #include <vector>
@@ -89,6 +113,15 @@ struct TRemoveFirst<TTypeList<T, Args...>> {
    using Types_t = TTypeList<Args...>;
 };
 
+// extract first type from TypeList
+template <typename>
+struct TTakeFirst { };
+
+template <typename T, typename... Args>
+struct TTakeFirst<TTypeList<T, Args...>> {
+   using Type_t = T;
+};
+
 // return wrapper around f that prepends an `unsigned int slot` parameter
 template <typename R, typename F, typename... Args>
 std::function<R(unsigned int, Args...)> AddSlotParameter(F f, TTypeList<Args...>)
@@ -140,6 +173,17 @@ struct TIsContainer {
    static const bool fgValue = Test<Test_t>(nullptr);
 };
 
+// whether at least one of the types is a container
+template <typename... Ts>
+struct TIsAnyContainer {
+   static const bool fgValue = false;
+};
+
+template <typename T, typename... Ts>
+struct TIsAnyContainer<T, Ts...> {
+   static const bool fgValue = TIsContainer<T>::fgValue || TIsAnyContainer<Ts...>::fgValue;
+};
+
 } // end NS TDFTraitsUtils
 
 } // end NS Internal
@@ -155,6 +199,267 @@ namespace Details {
 class TDataFrameImpl;
 }
 
+/// The progress of an event loop, passed to the callbacks registered with TActionResultProxy::OnPartialResult
+struct TLoopProgress {
+   ULong64_t fNEntries;      ///< Entries processed, by the slot or by all slots
+   double fElapsed;          ///< Seconds since the event loop started
+   double fEntriesPerSecond; ///< fNEntries / fElapsed
+   int fSlot;                ///< The slot whose partial result is passed, -1 if the results of all slots are merged
+};
+
+/// Count, sum, mean, variance, minimum and maximum of a set of values, the result of TDataFrameInterface::Stats.
+/// The values are seen once: the mean and the sum of the squared deviations from it are updated with Welford's
+/// algorithm and the sum is compensated (Neumaier), so that no precision is lost as the number of values grows.
+/// Deviations are taken from the first value, which keeps the precision of the variance of values with a large
+/// mean. Two sets of statistics are merged with the pairwise formulas of Chan et al.
+class TStatistics {
+   ULong64_t fN = 0;
+   double fSum = 0.;
+   double fSumCompensation = 0.; ///< Low-order bits lost by fSum
+   double fShift = 0.;           ///< The first value, subtracted from all values
+   double fShiftedMean = 0.;     ///< The mean of the values minus fShift
+   double fM2 = 0.;              ///< Sum of the squared deviations from the mean
+   double fMin = std::numeric_limits<double>::max();
+   double fMax = std::numeric_limits<double>::lowest();
+
+   void AddToSum(double v)
+   {
+      const auto sum = fSum + v;
+      if (std::abs(fSum) >= std::abs(v))
+         fSumCompensation += (fSum - sum) + v;
+      else
+         fSumCompensation += (v - sum) + fSum;
+      fSum = sum;
+   }
+
+public:
+   void Fill(double v)
+   {
+      if (fN == 0) fShift = v;
+      ++fN;
+      AddToSum(v);
+      const auto x = v - fShift;
+      const auto delta = x - fShiftedMean;
+      fShiftedMean += delta / fN;
+      fM2 += delta * (x - fShiftedMean);
+      if (v < fMin) fMin = v;
+      if (v > fMax) fMax = v;
+   }
+
+   void Merge(const TStatistics &other)
+   {
+      if (other.fN == 0) return;
+      if (fN == 0) {
+         *this = other;
+         return;
+      }
+      const double n = fN;
+      const double otherN = other.fN;
+      const auto delta = (other.fShiftedMean + (other.fShift - fShift)) - fShiftedMean;
+      fShiftedMean += delta * otherN / (n + otherN);
+      fM2 += other.fM2 + delta * delta * n * otherN / (n + otherN);
+      fN += other.fN;
+      AddToSum(other.fSum);
+      AddToSum(other.fSumCompensation);
+      if (other.fMin < fMin) fMin = other.fMin;
+      if (other.fMax > fMax) fMax = other.fMax;
+   }
+
+   ULong64_t GetN() const { return fN; }
+   double GetSum() const { return fSum + fSumCompensation; }
+   /// 0 if there are no values
+   double GetMean() const { return fShift + fShiftedMean; }
+   /// The unbiased estimate of the variance, with N - 1 degrees of freedom; 0 if there are less than two values
+   double GetVariance() const { return fN > 1 ? fM2 / (fN - 1) : 0.; }
+   double GetStdDev() const { return std::sqrt(GetVariance()); }
+   /// std::numeric_limits<double>::max() if there are no values
+   double GetMin() const { return fMin; }
+   /// std::numeric_limits<double>::lowest() if there are no values
+   double GetMax() const { return fMax; }
+};
+
+namespace Internal {
+/// Values without a default constructor cannot be written in place: the chunks are appended one after the other
+template <typename T, typename Chunks_t>
+void AppendChunks(std::vector<T> &dest, Chunks_t &chunks, bool moveValues, std::false_type /*isDefaultConstructible*/)
+{
+   auto size = dest.size();
+   for (auto &chunk : chunks) size += chunk.size();
+   dest.reserve(size);
+   for (auto &chunk : chunks) {
+      if (moveValues)
+         dest.insert(dest.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+      else
+         dest.insert(dest.end(), chunk.begin(), chunk.end());
+   }
+}
+
+template <typename T, typename Chunks_t>
+void AppendChunks(std::vector<T> &dest, Chunks_t &chunks, bool moveValues, std::true_type /*isDefaultConstructible*/)
+{
+   std::vector<std::size_t> offsets;
+   auto size = dest.size();
+   for (auto &chunk : chunks) {
+      offsets.emplace_back(size);
+      size += chunk.size();
+   }
+   dest.resize(size);
+   const unsigned int nChunks = offsets.size();
+   auto transferChunk = [&dest, &chunks, &offsets, moveValues](unsigned int i) {
+      auto &chunk = chunks[i];
+      const auto out = dest.begin() + offsets[i];
+      if (moveValues)
+         std::move(chunk.begin(), chunk.end(), out);
+      else
+         std::copy(chunk.begin(), chunk.end(), out);
+   };
+#ifdef R__USE_IMT
+   // the values of a std::vector<bool> share their words: they cannot be written by several threads
+   if (ROOT::IsImplicitMTEnabled() && nChunks > 1 && !std::is_same<T, bool>::value) {
+      ROOT::TThreadExecutor pool;
+      pool.Foreach(transferChunk, ROOT::TSeqU(nChunks));
+      return;
+   }
+#endif // R__USE_IMT
+   for (unsigned int i = 0; i < nChunks; ++i) transferChunk(i);
+}
+
+/// Append the values of the chunks to dest, with a single allocation. The chunks are transferred to consecutive
+/// ranges of dest in parallel if implicit multi-threading is enabled; their values are moved if moveValues.
+template <typename T, typename Chunks_t>
+void AppendChunks(std::vector<T> &dest, Chunks_t &chunks, bool moveValues)
+{
+   AppendChunks(dest, chunks, moveValues, std::is_default_constructible<T>());
+}
+} // end NS Internal
+
+/// The values collected by Take<T, TChunkedVector<T>>: the collections filled by the processing slots, handed
+/// over without copies. Iteration goes through the chunks one after the other. Flatten copies all values to a
+/// single std::vector.
+template <typename T>
+class TChunkedVector {
+   using Chunks_t = std::vector<std::vector<T>>;
+
+   template <typename V, typename ChunkIt_t>
+   class TIterator : public std::iterator<std::forward_iterator_tag, V> {
+      ChunkIt_t fChunk;
+      ChunkIt_t fEnd;
+      std::size_t fIndex = 0; ///< The position in *fChunk. Chunks are never empty.
+
+   public:
+      TIterator() = default;
+      TIterator(ChunkIt_t chunk, ChunkIt_t end) : fChunk(chunk), fEnd(end) {}
+      V &operator*() const { return (*fChunk)[fIndex]; }
+      V *operator->() const { return &(*fChunk)[fIndex]; }
+      TIterator &operator++()
+      {
+         if (++fIndex == fChunk->size()) {
+            ++fChunk;
+            fIndex = 0;
+         }
+         return *this;
+      }
+      TIterator operator++(int)
+      {
+         auto old = *this;
+         ++*this;
+         return old;
+      }
+      bool operator==(const TIterator &other) const { return fChunk == other.fChunk && fIndex == other.fIndex; }
+      bool operator!=(const TIterator &other) const { return !(*this == other); }
+   };
+
+   Chunks_t fChunks;
+
+public:
+   using value_type = T;
+   using iterator = TIterator<T, typename Chunks_t::iterator>;
+   using const_iterator = TIterator<const T, typename Chunks_t::const_iterator>;
+
+   TChunkedVector() = default;
+   /// Empty chunks are dropped
+   explicit TChunkedVector(Chunks_t &&chunks)
+   {
+      for (auto &chunk : chunks)
+         if (!chunk.empty()) fChunks.emplace_back(std::move(chunk));
+   }
+
+   const Chunks_t &GetChunks() const { return fChunks; }
+   std::size_t size() const
+   {
+      std::size_t size = 0;
+      for (auto &chunk : fChunks) size += chunk.size();
+      return size;
+   }
+   bool empty() const { return fChunks.empty(); }
+
+   /// All values in a single std::vector, allocated once and filled in parallel if implicit multi-threading is enabled
+   std::vector<T> Flatten() const
+   {
+      std::vector<T> values;
+      Internal::AppendChunks(values, fChunks, false);
+      return values;
+   }
+
+   iterator begin() { return iterator(fChunks.begin(), fChunks.end()); }
+   iterator end() { return iterator(fChunks.end(), fChunks.end()); }
+   const_iterator begin() const { return const_iterator(fChunks.begin(), fChunks.end()); }
+   const_iterator end() const { return const_iterator(fChunks.end(), fChunks.end()); }
+};
+
+/// A view on the values of an array branch in the current entry, e.g. a variable-size C-style array `x[n]/F`
+/// or a `std::vector<float>`, read through a TTreeReaderArray: the values are read from the buffers of the
+/// branch, without copies. Filters, temporary branches and actions take it as a parameter in place of a
+/// collection, e.g. `Filter([](const ROOT::TArrayBranch<float> &x) { return x.size() > 2 && x[2] > 0; }, {"x"})`.
+/// A view is only valid during the call it is passed to.
+template <typename T>
+class TArrayBranch {
+   template <typename V>
+   class TIterator : public std::iterator<std::forward_iterator_tag, V> {
+      TTreeReaderArray<T> *fArray = nullptr;
+      std::size_t fIndex = 0;
+
+   public:
+      TIterator() = default;
+      TIterator(TTreeReaderArray<T> *array, std::size_t index) : fArray(array), fIndex(index) {}
+      V &operator*() const { return (*fArray)[fIndex]; }
+      V *operator->() const { return &(*fArray)[fIndex]; }
+      TIterator &operator++()
+      {
+         ++fIndex;
+         return *this;
+      }
+      TIterator operator++(int)
+      {
+         auto old = *this;
+         ++fIndex;
+         return old;
+      }
+      bool operator==(const TIterator &other) const { return fIndex == other.fIndex && fArray == other.fArray; }
+      bool operator!=(const TIterator &other) const { return !(*this == other); }
+   };
+
+   TTreeReaderArray<T> *fArray = nullptr;
+
+public:
+   using value_type = T;
+   using iterator = TIterator<T>;
+   using const_iterator = TIterator<const T>;
+
+   TArrayBranch() = default;
+   explicit TArrayBranch(TTreeReaderArray<T> &array) : fArray(&array) {}
+
+   std::size_t size() const { return fArray ? fArray->GetSize() : 0; }
+   bool empty() const { return size() == 0; }
+   T &operator[](std::size_t i) { return (*fArray)[i]; }
+   const T &operator[](std::size_t i) const { return (*fArray)[i]; }
+
+   iterator begin() { return iterator(fArray, 0); }
+   iterator end() { return iterator(fArray, size()); }
+   const_iterator begin() const { return const_iterator(fArray, 0); }
+   const_iterator end() const { return const_iterator(fArray, size()); }
+};
+
 /// Smart pointer for the return type of actions
 /**
 * \class ROOT::TActionResultProxy
@@ -233,6 +538,157 @@ public:
       if (!*fReadiness) TriggerRun();
       return TIterationHelper<T>::GetEnd(*fObjPtr);
    }
+   /// Call `callback` during the event loop, every `everyNEntries` entries processed, with a snapshot of the
+   /// partial result and the progress of the loop. See the definition for details.
+   void OnPartialResult(ULong64_t everyNEntries, const std::function<void(const T &, const TLoopProgress &)> &callback,
+                        bool perSlot = false);
+};
+
+/// The statistics of a filter during an event loop
+class TCutInfo {
+   std::string fName;
+   ULong64_t fAll;
+   ULong64_t fAccepted;
+   double fCumulativeEff;
+
+public:
+   TCutInfo(const std::string &name, ULong64_t all, ULong64_t accepted, double cumulativeEff)
+      : fName(name), fAll(all), fAccepted(accepted), fCumulativeEff(cumulativeEff) { }
+   /// The name given to the filter, empty if the filter has no name
+   const std::string &GetName() const { return fName; }
+   /// The number of entries that reached the filter, i.e. that passed all the filters upstream
+   ULong64_t GetAll() const { return fAll; }
+   ULong64_t GetAccepted() const { return fAccepted; }
+   ULong64_t GetRejected() const { return fAll - fAccepted; }
+   /// The fraction of the entries reaching the filter that pass it
+   double GetEff() const { return fAll > 0 ? double(fAccepted) / fAll : 0.; }
+   /// The fraction of the entries reaching the first filter of the chain that pass this filter
+   double GetCumulativeEff() const { return fCumulativeEff; }
+};
+
+/**
+* \class ROOT::TCutFlowReport
+* \brief The statistics of a chain of filters, in the order the filters were declared.
+*
+* Returned by TDataFrameInterface::Report. Iterating over the report yields
+* one TCutInfo per filter, the most upstream one first.
+*/
+class TCutFlowReport {
+   std::vector<TCutInfo> fCutInfos;
+
+public:
+   using const_iterator = std::vector<TCutInfo>::const_iterator;
+
+   void AddCut(const std::string &name, ULong64_t all, ULong64_t accepted)
+   {
+      const auto first = fCutInfos.empty() ? all : fCutInfos.front().GetAll();
+      fCutInfos.emplace_back(name, all, accepted, first > 0 ? double(accepted) / first : 0.);
+   }
+
+   /// The statistics of the filter with the given name. Throws if no filter in the chain has that name.
+   const TCutInfo &At(const std::string &name) const
+   {
+      for (auto &cut : fCutInfos)
+         if (cut.GetName() == name) return cut;
+      throw std::runtime_error("no filter named \"" + name + "\" in the report");
+   }
+
+   const TCutInfo &operator[](std::size_t i) const { return fCutInfos[i]; }
+   std::size_t size() const { return fCutInfos.size(); }
+   const_iterator begin() const { return fCutInfos.begin(); }
+   const_iterator end() const { return fCutInfos.end(); }
+
+   /// Print one line per filter: entries reaching it and passing it, efficiency and cumulative efficiency
+   void Print() const
+   {
+      for (auto &cut : fCutInfos) {
+         std::cout << (cut.GetName().empty() ? "<unnamed>" : cut.GetName()) << ": pass=" << cut.GetAccepted()
+                   << " all=" << cut.GetAll() << " -- eff=" << 100. * cut.GetEff()
+                   << " % cumulative eff=" << 100. * cut.GetCumulativeEff() << " %" << std::endl;
+      }
+   }
+};
+
+/// The wall time spent in a node of the graph, or in the reader, and the number of calls, summed over all slots
+class TNodeProfile {
+   std::string fKind;
+   std::string fName;
+   ULong64_t fNCalls;
+   double fTime;
+
+public:
+   TNodeProfile(const std::string &kind, const std::string &name, ULong64_t nCalls, double time)
+      : fKind(kind), fName(name), fNCalls(nCalls), fTime(time) { }
+   /// "filter", "branch", "action" or "reader"
+   const std::string &GetKind() const { return fKind; }
+   /// The name of the filter or temporary branch, the branches read by an action, the operation of the reader
+   const std::string &GetName() const { return fName; }
+   ULong64_t GetNCalls() const { return fNCalls; }
+   /// Wall time in seconds
+   double GetTime() const { return fTime; }
+};
+
+/**
+* \class ROOT::TDataFrameProfile
+* \brief Where the time of the last profiled event loop of a data frame went.
+*
+* Times are inclusive: the time of a filter, temporary branch or action includes
+* the evaluation of the temporary branches it reads for the first time in an
+* entry, and the reader loads they trigger. The time spent loading the values
+* of real branches, and in moving the reader to the next entry, is also
+* reported on its own.
+*/
+class TDataFrameProfile {
+   std::vector<TNodeProfile> fNodes;
+   TNodeProfile fReaderNext{"reader", "Next", 0, 0.};
+   TNodeProfile fReaderLoad{"reader", "Load", 0, 0.};
+
+   static std::string Quote(const std::string &str)
+   {
+      std::string quoted = "\"";
+      for (auto c : str) {
+         if (c == '"' || c == '\\') quoted += '\\';
+         quoted += c;
+      }
+      return quoted + '"';
+   }
+
+   static void WriteJSON(std::ostringstream &os, const TNodeProfile &node)
+   {
+      os << "{\"kind\": " << Quote(node.GetKind()) << ", \"name\": " << Quote(node.GetName())
+         << ", \"calls\": " << node.GetNCalls() << ", \"time\": " << node.GetTime() << "}";
+   }
+
+public:
+   void AddNode(const std::string &kind, const std::string &name, ULong64_t nCalls, double time)
+   {
+      fNodes.emplace_back(kind, name, nCalls, time);
+   }
+   void SetReaderNext(ULong64_t nCalls, double time) { fReaderNext = TNodeProfile("reader", "Next", nCalls, time); }
+   void SetReaderLoad(ULong64_t nCalls, double time) { fReaderLoad = TNodeProfile("reader", "Load", nCalls, time); }
+
+   /// The filters, temporary branches and actions of the graph
+   const std::vector<TNodeProfile> &GetNodes() const { return fNodes; }
+   /// The calls to TTreeReader::Next
+   const TNodeProfile &GetReaderNext() const { return fReaderNext; }
+   /// The loads of the values of real branches
+   const TNodeProfile &GetReaderLoad() const { return fReaderLoad; }
+
+   std::string ToJSON() const
+   {
+      std::ostringstream os;
+      os << "{\"reader\": [";
+      WriteJSON(os, fReaderNext);
+      os << ", ";
+      WriteJSON(os, fReaderLoad);
+      os << "], \"nodes\": [";
+      for (unsigned int i = 0; i < fNodes.size(); ++i) {
+         if (i > 0) os << ", ";
+         WriteJSON(os, fNodes[i]);
+      }
+      os << "]}";
+      return os.str();
+   }
 };
 
 } // end NS ROOT
@@ -242,6 +698,10 @@ namespace ROOT {
 
 namespace Details {
 class TDataFrameImpl;
+class TDataFrameBranchBase;
+class TDataFrameFilterBase;
+template <typename T>
+class TDataFrameCachedColumn;
 }
 
 namespace Internal {
@@ -254,1080 +714,4233 @@ unsigned int GetNSlots() {
    return nSlots;
 }
 
-using TVBPtr_t = std::shared_ptr<TTreeReaderValueBase>;
-using TVBVec_t = std::vector<TVBPtr_t>;
+/// Size of the cache lines that per-slot state is padded to
+constexpr std::size_t kCacheLineSize = 64;
 
-template <int... S, typename... BranchTypes>
-TVBVec_t BuildReaderValues(TTreeReader &r, const BranchNames &bl, const BranchNames &tmpbl,
-                           TDFTraitsUtils::TTypeList<BranchTypes...>,
-                           TDFTraitsUtils::TStaticSeq<S...>)
-{
-   // isTmpBranch has length bl.size(). Elements are true if the corresponding
-   // branch is a "fake" branch created with AddBranch, false if they are
-   // actual branches present in the TTree.
-   std::array<bool, sizeof...(S)> isTmpBranch;
-   for (unsigned int i = 0; i < isTmpBranch.size(); ++i)
-      isTmpBranch[i] = std::find(tmpbl.begin(), tmpbl.end(), bl.at(i)) != tmpbl.end();
+/// Storage for one object of type T per processing slot.
+/// Every object sits on cache lines of its own: threads that update the state of
+/// different slots never write to the same cache line, i.e. there is no false sharing.
+/// Objects are value-initialized, or copies of an initial value, and are iterated in slot order.
+template <typename T>
+class TSlotStorage {
+   struct alignas(kCacheLineSize) TPadded {
+      T fValue;
+      TPadded() : fValue() {}
+      TPadded(const T &init) : fValue(init) {}
+   };
 
-   // Build vector of pointers to TTreeReaderValueBase.
-   // tvb[i] points to a TTreeReaderValue specialized for the i-th BranchType,
-   // corresponding to the i-th branch in bl
-   // For temporary branches (declared with AddBranch) a nullptr is created instead
-   // S is expected to be a sequence of sizeof...(BranchTypes) integers
-   TVBVec_t tvb{isTmpBranch[S] ? nullptr : std::make_shared<TTreeReaderValue<BranchTypes>>(
-                                            r, bl.at(S).c_str())...}; // "..." expands BranchTypes and S simultaneously
+   template <typename V, typename P>
+   class TIterator : public std::iterator<std::forward_iterator_tag, V> {
+      P *fPtr = nullptr;
 
-   return tvb;
-}
+   public:
+      TIterator() = default;
+      explicit TIterator(P *ptr) : fPtr(ptr) {}
+      V &operator*() const { return fPtr->fValue; }
+      V *operator->() const { return &fPtr->fValue; }
+      TIterator &operator++()
+      {
+         ++fPtr;
+         return *this;
+      }
+      TIterator operator++(int)
+      {
+         auto old = *this;
+         ++fPtr;
+         return old;
+      }
+      bool operator==(const TIterator &other) const { return fPtr == other.fPtr; }
+      bool operator!=(const TIterator &other) const { return fPtr != other.fPtr; }
+   };
 
-template <typename Filter>
-void CheckFilter(Filter f)
-{
-   using FilterRet_t = typename TDFTraitsUtils::TFunctionTraits<Filter>::RetType_t;
-   static_assert(std::is_same<FilterRet_t, bool>::value, "filter functions must return a bool");
-}
+   std::unique_ptr<char[]> fBuffer;
+   TPadded *fSlots = nullptr;
+   unsigned int fNSlots = 0;
 
-void CheckTmpBranch(const std::string& branchName, TTree *treePtr)
-{
-   auto branch = treePtr->GetBranch(branchName.c_str());
-   if (branch != nullptr) {
-      auto msg = "branch \"" + branchName + "\" already present in TTree";
-      throw std::runtime_error(msg);
+   template <typename... Init>
+   void Allocate(unsigned int nSlots, const Init &... init)
+   {
+      Clear();
+      if (nSlots == 0) return;
+      // one extra element leaves room to align the first one to a cache line boundary
+      std::size_t space = (nSlots + 1) * sizeof(TPadded);
+      fBuffer.reset(new char[space]);
+      void *ptr = fBuffer.get();
+      std::align(alignof(TPadded), nSlots * sizeof(TPadded), ptr, space);
+      fSlots = static_cast<TPadded *>(ptr);
+      for (; fNSlots < nSlots; ++fNSlots) new (fSlots + fNSlots) TPadded(init...);
    }
-}
 
-/// Returns local BranchNames or default BranchNames according to which one should be used
-const BranchNames &PickBranchNames(unsigned int nArgs, const BranchNames &bl, const BranchNames &defBl)
-{
-   bool useDefBl = false;
-   if (nArgs != bl.size()) {
-      if (bl.size() == 0 && nArgs == defBl.size()) {
-         useDefBl = true;
-      } else {
-         auto msg = "mismatch between number of filter arguments (" + std::to_string(nArgs) +
-                    ") and number of branches (" + std::to_string(bl.size() ? bl.size() : defBl.size()) + ")";
-         throw std::runtime_error(msg);
-      }
+   void Clear()
+   {
+      for (unsigned int i = 0; i < fNSlots; ++i) fSlots[i].~TPadded();
+      fNSlots = 0;
+      fSlots = nullptr;
+      fBuffer.reset();
    }
 
-   return useDefBl ? defBl : bl;
-}
-
-class TDataFrameActionBase {
 public:
-   virtual ~TDataFrameActionBase() {}
-   virtual void Run(unsigned int slot, int entry) = 0;
-   virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
-   virtual void CreateSlots(unsigned int nSlots) = 0;
+   using iterator = TIterator<T, TPadded>;
+   using const_iterator = TIterator<const T, const TPadded>;
+
+   TSlotStorage() = default;
+   explicit TSlotStorage(unsigned int nSlots) { Allocate(nSlots); }
+   TSlotStorage(unsigned int nSlots, const T &init) { Allocate(nSlots, init); }
+   TSlotStorage(const TSlotStorage &) = delete;
+   TSlotStorage &operator=(const TSlotStorage &) = delete;
+   ~TSlotStorage() { Clear(); }
+
+   /// Discard the current objects and create nSlots value-initialized ones
+   void Reset(unsigned int nSlots) { Allocate(nSlots); }
+   /// Discard the current objects and create nSlots copies of init
+   void Reset(unsigned int nSlots, const T &init) { Allocate(nSlots, init); }
+
+   T &operator[](unsigned int slot) { return fSlots[slot].fValue; }
+   const T &operator[](unsigned int slot) const { return fSlots[slot].fValue; }
+   unsigned int size() const { return fNSlots; }
+
+   iterator begin() { return iterator(fSlots); }
+   iterator end() { return iterator(fSlots + fNSlots); }
+   const_iterator begin() const { return const_iterator(fSlots); }
+   const_iterator end() const { return const_iterator(fSlots + fNSlots); }
 };
 
-using ActionBasePtr_t = std::shared_ptr<TDataFrameActionBase>;
-using ActionBaseVec_t = std::vector<ActionBasePtr_t>;
-
-// Forward declarations
-template <int S, typename T>
-T &GetBranchValue(TVBPtr_t &readerValues, unsigned int slot, int entry, const std::string &branch,
-                  std::weak_ptr<Details::TDataFrameImpl> df);
-
-template <typename F, typename PrevDataFrame>
-class TDataFrameAction final : public TDataFrameActionBase {
-   using BranchTypes_t = typename TDFTraitsUtils::TRemoveFirst<typename TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t>::Types_t;
-   using TypeInd_t = typename TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
-
-   F fAction;
-   const BranchNames fBranches;
-   const BranchNames fTmpBranches;
-   PrevDataFrame *fPrevData;
-   std::weak_ptr<Details::TDataFrameImpl> fFirstData;
-   std::vector<TVBVec_t> fReaderValues;
+/// Lock-free pool of slot indexes.
+/// A task checks a free slot out before processing entries and returns it when done:
+/// the state of a slot belongs to the task holding it, not to the thread executing the task.
+/// Acquiring a slot never waits. A task that finds all slots taken has nothing to do, since the
+/// tasks holding the slots keep processing entries until there are none left. Tasks can therefore
+/// nest: a worker waiting for the parallel work of a filter or action may run another task of the
+/// same event loop, which returns at once instead of waiting for a slot held below it.
+class TSlotPool {
+   TSlotStorage<std::atomic<bool>> fInUse;
 
 public:
-   TDataFrameAction(F f, const BranchNames &bl, std::weak_ptr<PrevDataFrame> pd)
-      : fAction(f), fBranches(bl), fTmpBranches(pd.lock()->GetTmpBranches()), fPrevData(pd.lock().get()),
-        fFirstData(pd.lock()->GetDataFrame()) { }
-
-   TDataFrameAction(const TDataFrameAction &) = delete;
-
-   void Run(unsigned int slot, int entry)
-   {
-      // check if entry passes all filters
-      if (CheckFilters(slot, entry)) ExecuteAction(slot, entry);
-   }
+   explicit TSlotPool(unsigned int nSlots) : fInUse(nSlots) {}
 
-   bool CheckFilters(unsigned int slot, int entry)
+   /// Check a free slot out. Returns false if all slots are taken.
+   bool TryAcquire(unsigned int &slot)
    {
-      // start the recursive chain of CheckFilters calls
-      return fPrevData->CheckFilters(slot, entry);
+      for (slot = 0; slot < fInUse.size(); ++slot) {
+         auto &inUse = fInUse[slot];
+         if (!inUse.load(std::memory_order_relaxed) && !inUse.exchange(true, std::memory_order_acquire)) return true;
+      }
+      return false;
    }
 
-   void ExecuteAction(unsigned int slot, int entry) { ExecuteActionHelper(slot, entry, TypeInd_t(), BranchTypes_t()); }
+   void Release(unsigned int slot) { fInUse[slot].store(false, std::memory_order_release); }
+};
 
-   void CreateSlots(unsigned int nSlots) { fReaderValues.resize(nSlots); }
+/// Holds a slot of a TSlotPool, if one is free, for its lifetime, so that the slot is returned also when
+/// the processing of the entries throws
+class TSlotGuard {
+   TSlotPool &fPool;
+   unsigned int fSlot = 0;
+   const bool fHasSlot;
 
-   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+public:
+   explicit TSlotGuard(TSlotPool &pool) : fPool(pool), fHasSlot(pool.TryAcquire(fSlot)) {}
+   TSlotGuard(const TSlotGuard &) = delete;
+   TSlotGuard &operator=(const TSlotGuard &) = delete;
+   ~TSlotGuard()
    {
-      fReaderValues[slot] = ROOT::Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      if (fHasSlot) fPool.Release(fSlot);
    }
 
-   template <int... S, typename... BranchTypes>
-   void ExecuteActionHelper(unsigned int slot, int entry,
-                            TDFTraitsUtils::TStaticSeq<S...>,
-                            TDFTraitsUtils::TTypeList<BranchTypes...>)
-   {
-      // Take each pointer in tvb, cast it to a pointer to the
-      // correct specialization of TTreeReaderValue, and get its content.
-      // S expands to a sequence of integers 0 to sizeof...(types)-1
-      // S and types are expanded simultaneously by "..."
-      fAction(slot, GetBranchValue<S, BranchTypes>(fReaderValues[slot][S], slot, entry, fBranches[S], fFirstData)...);
-   }
+   bool HasSlot() const { return fHasSlot; }
+   unsigned int GetSlot() const { return fSlot; }
 };
 
-namespace Operations {
-using namespace Internal::TDFTraitsUtils;
-using Count_t = unsigned long;
+/// Wall time and number of calls accumulated by a node of the graph, or by the reader, in one slot
+struct TProfileCounters {
+   ULong64_t fNCalls = 0;
+   double fTime = 0.; ///< Seconds
+};
 
-class CountOperation {
-   unsigned int *fResultCount;
-   std::vector<Count_t> fCounts;
+using ProfileStorage_t = TSlotStorage<TProfileCounters>;
 
-public:
-   CountOperation(unsigned int *resultCount, unsigned int nSlots) : fResultCount(resultCount), fCounts(nSlots, 0) {}
+/// Adds the time elapsed between its construction and its destruction to the counters, if any, as
+/// well as the number of calls it measures: one, or the number of entries of a block processed at once.
+/// Without counters, i.e. when the event loop is not profiled, it does nothing.
+class TProfileTimer {
+   TProfileCounters *fCounters;
+   const ULong64_t fNCalls;
+   std::chrono::steady_clock::time_point fStart;
 
-   void Exec(unsigned int slot)
+public:
+   explicit TProfileTimer(TProfileCounters *counters, ULong64_t nCalls = 1) : fCounters(counters), fNCalls(nCalls)
    {
-      fCounts[slot]++;
+      if (fCounters) fStart = std::chrono::steady_clock::now();
    }
-
-   ~CountOperation()
+   TProfileTimer(const TProfileTimer &) = delete;
+   ~TProfileTimer()
    {
-      *fResultCount = 0;
-      for (auto &c : fCounts) {
-         *fResultCount += c;
-      }
+      if (!fCounters) return;
+      fCounters->fNCalls += fNCalls;
+      fCounters->fTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
    }
 };
 
-class FillOperation {
-   // this sets a total initial size of 16 MB for the buffers (can increase)
-   static constexpr unsigned int fgTotalBufSize = 2097152;
-   using BufEl_t = double;
-   using Buf_t = std::vector<BufEl_t>;
-
-   std::vector<Buf_t> fBuffers;
-   std::shared_ptr<TH1F> fResultHist;
-   unsigned int fBufSize;
-   Buf_t fMin;
-   Buf_t fMax;
+/// The counters of a slot, or nullptr if the storage is empty because the event loop is not profiled
+TProfileCounters *GetSlotCounters(ProfileStorage_t &counters, unsigned int slot)
+{
+   return counters.size() > 0 ? &counters[slot] : nullptr;
+}
 
-   template <typename T>
-   void UpdateMinMax(unsigned int slot, T v) {
-      auto& thisMin = fMin[slot];
-      auto& thisMax = fMax[slot];
-      thisMin = std::min(thisMin, (BufEl_t)v);
-      thisMax = std::max(thisMax, (BufEl_t)v);
+TProfileCounters *GetSlotCounters(ProfileStorage_t *counters, unsigned int slot)
+{
+   return counters ? GetSlotCounters(*counters, slot) : nullptr;
+}
+
+/// Allocate the counters of a node, and point it to the counters of the reader loads, if its data frame is profiled
+template <typename DataFrame>
+void SetUpProfiling(DataFrame &df, unsigned int nSlots, ProfileStorage_t &counters, ProfileStorage_t *&loadCounters)
+{
+   const bool isProfiled = df.GetProfiling();
+   counters.Reset(isProfiled ? nSlots : 0);
+   loadCounters = isProfiled ? &df.GetLoadCounters() : nullptr;
+}
+
+/// The number of entries per block of the event loop of a data frame, 0 if it processes one entry at a time
+template <typename DataFrame>
+unsigned int GetLoopBatchSize(DataFrame &df)
+{
+   return df.GetLoopBatchSize();
+}
+
+/// The sum of the counters of all slots
+TProfileCounters SumCounters(const ProfileStorage_t &counters)
+{
+   TProfileCounters sum;
+   for (auto &c : counters) {
+      sum.fNCalls += c.fNCalls;
+      sum.fTime += c.fTime;
    }
+   return sum;
+}
+
+/// The names of the branches, comma-separated
+std::string JoinNames(const BranchNames &names)
+{
+   std::string joined;
+   for (auto &name : names) joined += (joined.empty() ? "" : ",") + name;
+   return joined;
+}
 
+/// Calls the progress callbacks registered on the results of a data frame while its event loop runs.
+/// The partial results of each slot are guarded by a spin lock of that slot: the slot holds it while it
+/// processes an entry, a callback holds it while it reads the partial results of the slot, and a slot
+/// lets a waiting callback go first before its next entry. Slots never wait for each other, only for a
+/// callback reading their own results; a global callback locks the slots one at a time. Slots publish
+/// their entry counts to the global count in chunks.
+class TProgressMonitor {
 public:
-   FillOperation(std::shared_ptr<TH1F> h, unsigned int nSlots) : fResultHist(h),
-                                                                 fBufSize (fgTotalBufSize / nSlots),
-                                                                 fMin(nSlots, std::numeric_limits<BufEl_t>::max()),
-                                                                 fMax(nSlots, std::numeric_limits<BufEl_t>::min())
-   {
-      fBuffers.reserve(nSlots);
-      for (unsigned int i=0; i<nSlots; ++i) {
-         Buf_t v;
-         v.reserve(fBufSize);
-         fBuffers.emplace_back(v);
+   /// Merges the partial results of the slots, then calls the user callback
+   using Callback_t =
+      std::function<void(TProgressMonitor &monitor, const std::vector<unsigned int> &slots, const TLoopProgress &)>;
+
+   /// Holds the lock of a slot while the slot processes an entry. Without monitor it does nothing.
+   class TSlotLock {
+      TProgressMonitor *fMonitor;
+      const unsigned int fSlot;
+
+   public:
+      TSlotLock(TProgressMonitor *monitor, unsigned int slot) : fMonitor(monitor), fSlot(slot)
+      {
+         if (!fMonitor) return;
+         auto &sync = fMonitor->fSyncs[fSlot];
+         while (sync.fNWaiting.load(std::memory_order_acquire) > 0) std::this_thread::yield();
+         sync.fMutex.lock();
+      }
+      TSlotLock(const TSlotLock &) = delete;
+      ~TSlotLock()
+      {
+         if (fMonitor) fMonitor->fSyncs[fSlot].fMutex.unlock();
       }
+   };
+
+private:
+   using Clock_t = std::chrono::steady_clock;
+
+   struct TCallback {
+      const ULong64_t fEveryN;
+      const bool fPerSlot;
+      const Callback_t fCallback;
+      std::atomic<bool> fIsFiring{false}; ///< Whether a global callback is running
+      TCallback(ULong64_t everyN, bool perSlot, const Callback_t &callback)
+         : fEveryN(everyN), fPerSlot(perSlot), fCallback(callback) { }
+   };
+
+   struct TSlotSync {
+      ROOT::TSpinMutex fMutex;
+      std::atomic<unsigned int> fNWaiting{0}; ///< Callbacks waiting to read the partial results of the slot
+   };
+
+   struct TSlotCounts {
+      ULong64_t fNEntries = 0;
+      ULong64_t fNUnpublished = 0; ///< Entries not added to the global count yet
+   };
+
+   std::deque<TCallback> fCallbacks; ///< A deque: callbacks are not movable
+   TSlotStorage<TSlotSync> fSyncs;
+   TSlotStorage<TSlotCounts> fCounts;
+   std::atomic<ULong64_t> fNEntries{0}; ///< Entries processed by all slots, as published by the slots
+   ULong64_t fPublishEvery = 0;          ///< Entries between two publications of the count of a slot, 0 if never
+   std::vector<unsigned int> fAllSlots;
+   Clock_t::time_point fStart;
+
+   void Fire(const TCallback &cb, const std::vector<unsigned int> &slots, ULong64_t nEntries, int slot)
+   {
+      const double elapsed = std::chrono::duration<double>(Clock_t::now() - fStart).count();
+      const TLoopProgress progress{nEntries, elapsed, elapsed > 0. ? nEntries / elapsed : 0., slot};
+      cb.fCallback(*this, slots, progress);
    }
 
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
+public:
+   void Add(ULong64_t everyN, bool perSlot, const Callback_t &callback)
    {
-      UpdateMinMax(slot, v);
-      fBuffers[slot].emplace_back(v);
+      fCallbacks.emplace_back(everyN, perSlot, callback);
    }
 
-   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(const T &vs, unsigned int slot)
+   /// Reset the counters before the event loop starts
+   void Start(unsigned int nSlots)
    {
-      auto& thisBuf = fBuffers[slot];
-      for (auto& v : vs) {
-         UpdateMinMax(slot, v);
-         thisBuf.emplace_back(v); // TODO: Can be optimised in case T == BufEl_t
+      fSyncs.Reset(nSlots);
+      fCounts.Reset(nSlots);
+      fNEntries = 0;
+      fAllSlots.resize(nSlots);
+      for (unsigned int i = 0; i < nSlots; ++i) fAllSlots[i] = i;
+      // the global count lags behind by less than half a period of the most frequent global callback.
+      // A single slot publishes every entry: callbacks are then called exactly every N entries.
+      fPublishEvery = 0;
+      for (auto &cb : fCallbacks) {
+         if (cb.fPerSlot) continue;
+         const ULong64_t publishEvery = nSlots == 1 ? 1 : std::max(cb.fEveryN / (2 * nSlots), ULong64_t(1));
+         fPublishEvery = fPublishEvery == 0 ? publishEvery : std::min(fPublishEvery, publishEvery);
       }
+      fStart = Clock_t::now();
    }
 
-   ~FillOperation()
+   /// Lock a slot to read its partial results
+   std::unique_lock<ROOT::TSpinMutex> LockSlot(unsigned int slot)
    {
+      auto &sync = fSyncs[slot];
+      ++sync.fNWaiting;
+      std::unique_lock<ROOT::TSpinMutex> lock(sync.fMutex);
+      --sync.fNWaiting;
+      return lock;
+   }
 
-      BufEl_t globalMin = *std::min_element(fMin.begin(), fMin.end());
-      BufEl_t globalMax = *std::max_element(fMax.begin(), fMax.end());
-
-      if (fResultHist->CanExtendAllAxes() &&
-          globalMin != std::numeric_limits<BufEl_t>::max() &&
-          globalMax != std::numeric_limits<BufEl_t>::min()) {
-         auto xaxis = fResultHist->GetXaxis();
-         fResultHist->ExtendAxis(globalMin, xaxis);
-         fResultHist->ExtendAxis(globalMax, xaxis);
-      }
-
-      for (auto& buf : fBuffers) {
-         Buf_t w(buf.size(),1); // A bug in FillN?
-         fResultHist->FillN(buf.size(), buf.data(),  w.data());
+   /// Count an entry processed by the slot, and call the callbacks that are due. Must be called
+   /// by the slot without holding its lock.
+   void EntryDone(unsigned int slot)
+   {
+      auto &counts = fCounts[slot];
+      ++counts.fNEntries;
+      for (auto &cb : fCallbacks)
+         if (cb.fPerSlot && counts.fNEntries % cb.fEveryN == 0) Fire(cb, {slot}, counts.fNEntries, slot);
+      if (fPublishEvery == 0 || ++counts.fNUnpublished < fPublishEvery) return;
+      const auto before = fNEntries.fetch_add(counts.fNUnpublished, std::memory_order_relaxed);
+      const auto after = before + counts.fNUnpublished;
+      counts.fNUnpublished = 0;
+      for (auto &cb : fCallbacks) {
+         // a global callback still running in another slot is not waited for: this call is skipped
+         if (!cb.fPerSlot && before / cb.fEveryN != after / cb.fEveryN && !cb.fIsFiring.exchange(true)) {
+            Fire(cb, fAllSlots, after, -1);
+            cb.fIsFiring = false;
+         }
       }
    }
 };
 
+/// A range of entries of one of the input files
+struct TEntryRange {
+   unsigned int fFileIdx; ///< Index of the file in the list of input files
+   Long64_t fBegin;
+   Long64_t fEnd;         ///< One past the last entry of the range
+};
 
-class FillTOOperation {
-   TThreadedObject<TH1F> fTo;
+/// A block of consecutive entries processed at once in batched mode
+struct TEntryBlock {
+   ULong64_t fId;        ///< Number of the block among those processed by the slot, starting from 1
+   Long64_t fFirst;      ///< The first entry of the block
+   unsigned int fSize;   ///< Number of entries in the block
+};
 
-public:
+/// The positions in a block of the entries selected by a node, in increasing order
+using TBlockSelection_t = std::vector<unsigned int>;
+
+/// The values of a column in the entries of a block. The array is allocated uninitialised: a value is
+/// constructed the first time its position is set and assigned to afterwards, so that T does not need to
+/// be default-constructible and values owning memory, e.g. vectors, reuse it from block to block.
+template <typename T>
+class TBlockValues {
+   T *fValues = nullptr;
+   std::vector<bool> fIsConstructed;
 
-   FillTOOperation(std::shared_ptr<TH1F> h, unsigned int nSlots) : fTo(*h)
+public:
+   TBlockValues() = default;
+   explicit TBlockValues(unsigned int size) { Allocate(size); }
+   TBlockValues(const TBlockValues &) = delete;
+   TBlockValues &operator=(const TBlockValues &) = delete;
+   ~TBlockValues() { Clear(); }
+
+   /// Discard the current values and allocate room for the values of a block of the given size
+   void Allocate(unsigned int size)
    {
-      fTo.SetAtSlot(0, h);
-      // Initialise all other slots
-      for (unsigned int i = 0 ; i < nSlots; ++i) {
-         fTo.GetAtSlot(i);
-      }
+      Clear();
+      fValues = static_cast<T *>(::operator new(size * sizeof(T)));
+      fIsConstructed.assign(size, false);
    }
 
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
+   void Clear()
    {
-      fTo.GetAtSlotUnchecked(slot)->Fill(v);
+      for (std::size_t pos = 0; pos < fIsConstructed.size(); ++pos)
+         if (fIsConstructed[pos]) fValues[pos].~T();
+      ::operator delete(fValues);
+      fValues = nullptr;
+      fIsConstructed.clear();
    }
 
-   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(const T &vs, unsigned int slot)
+   template <typename V>
+   void Set(unsigned int pos, V &&value)
    {
-      auto thisSlotH = fTo.GetAtSlotUnchecked(slot);
-      for (auto& v : vs) {
-         thisSlotH->Fill(v); // TODO: Can be optimised in case T == vector<double>
+      if (fIsConstructed[pos]) {
+         fValues[pos] = std::forward<V>(value);
+      } else {
+         new (fValues + pos) T(std::forward<V>(value));
+         fIsConstructed[pos] = true;
       }
    }
 
-   ~FillTOOperation()
-   {
-      fTo.Merge();
-   }
+   /// The values: only those at the positions set in the current block are valid
+   T *GetValues() { return fValues; }
+};
 
+/// Shared by a Cache transformation and the data frame reading the cached columns
+struct TCacheStatus {
+   ULong64_t fNEntries = 0; ///< Number of entries in each cached column
+   bool fIsFilled = false;  ///< Whether the event loop filling the cached columns has run
 };
 
-// note: changes to this class should probably be replicated in its partial
-// specialization below
-template<typename T, typename COLL>
-class TakeOperation {
-   std::vector<std::shared_ptr<COLL>> fColls;
-public:
-   TakeOperation(std::shared_ptr<COLL> resultColl, unsigned int nSlots)
-   {
-      fColls.emplace_back(resultColl);
-      for (unsigned int i = 1; i < nSlots; ++i)
-         fColls.emplace_back(std::make_shared<COLL>());
-   }
+/// Splits the entries of a dataset in ranges and distributes them among the processing slots.
+/// Ranges are about `taskSize` entries long. Clusters smaller than that are grouped, so that
+/// no cluster is split unless it is larger than a task; large clusters are split in several ranges.
+/// Each slot initially owns a contiguous block of ranges and works through it from the front:
+/// a slot that runs out of work steals ranges from the back of the queues of the other slots.
+class TEntryRangeScheduler {
+   struct TSlotQueue {
+      ROOT::TSpinMutex fMutex;
+      std::deque<TEntryRange> fRanges;
+   };
 
-   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(V v, unsigned int slot)
-   {
-      fColls[slot]->emplace_back(v);
-   }
+   TSlotStorage<TSlotQueue> fQueues;
+   unsigned int fNRanges = 0;
 
-   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(const V &vs, unsigned int slot)
+   /// The entries at which the clusters of a tree start, followed by the number of entries
+   static std::vector<Long64_t> GetClusterBoundaries(TTree &tree)
    {
-      auto thisColl = fColls[slot];
-      thisColl.insert(std::begin(thisColl), std::begin(vs), std::begin(vs));
+      const auto nEntries = tree.GetEntries();
+      std::vector<Long64_t> boundaries{0};
+      auto clusterIt = tree.GetClusterIterator(0);
+      while (clusterIt.Next() < nEntries) boundaries.emplace_back(clusterIt.GetNextEntry());
+      return boundaries;
    }
 
-   ~TakeOperation()
+   static void SplitEntries(const std::vector<Long64_t> &boundaries, unsigned int fileIdx, Long64_t taskSize,
+                            std::vector<TEntryRange> &ranges)
    {
-      auto rColl = fColls[0];
-      for (unsigned int i = 1; i < fColls.size(); ++i) {
-         auto& coll = fColls[i];
-         for (T &v : *coll) {
-            rColl->emplace_back(v);
+      Long64_t rangeBegin = 0;
+      for (std::size_t i = 1; i < boundaries.size(); ++i) {
+         const auto clusterBegin = boundaries[i - 1];
+         const auto clusterEnd = boundaries[i];
+         const auto clusterSize = clusterEnd - clusterBegin;
+         if (clusterSize > taskSize) {
+            // close the pending range, then split the cluster in ranges of similar size
+            if (rangeBegin < clusterBegin) ranges.push_back({fileIdx, rangeBegin, clusterBegin});
+            const auto nRanges = (clusterSize + taskSize - 1) / taskSize;
+            for (Long64_t r = 0; r < nRanges; ++r)
+               ranges.push_back(
+                  {fileIdx, clusterBegin + r * clusterSize / nRanges, clusterBegin + (r + 1) * clusterSize / nRanges});
+            rangeBegin = clusterEnd;
+         } else if (clusterEnd - rangeBegin >= taskSize) {
+            ranges.push_back({fileIdx, rangeBegin, clusterEnd});
+            rangeBegin = clusterEnd;
          }
       }
+      if (rangeBegin < boundaries.back()) ranges.push_back({fileIdx, rangeBegin, boundaries.back()});
    }
-};
 
-// note: changes to this class should probably be replicated in its unspecialized
-// declaration above
-template<typename T>
-class TakeOperation<T, std::vector<T>> {
-   std::vector<std::shared_ptr<std::vector<T>>> fColls;
 public:
-   TakeOperation(std::shared_ptr<std::vector<T>> resultColl, unsigned int nSlots)
+   /// Number of ranges per slot used when no task size is specified
+   static constexpr unsigned int fgRangesPerSlot = 8;
+
+   /// The cluster boundaries of the tree in each of the input files. The files are opened in parallel, one task each.
+   static std::vector<std::vector<Long64_t>> GetClusterBoundaries(const std::vector<std::string> &fileNames,
+                                                                  const std::string &treeName)
    {
-      fColls.emplace_back(resultColl);
-      for (unsigned int i = 1; i < nSlots; ++i) {
-         auto v = std::make_shared<std::vector<T>>();
-         v->reserve(1024);
-         fColls.emplace_back(v);
+      // a file whose tree cannot be read is left with no boundaries: the error is reported outside of the tasks
+      std::vector<std::vector<Long64_t>> boundaries(fileNames.size());
+      auto readBoundaries = [&fileNames, &treeName, &boundaries](unsigned int fileIdx) {
+         std::unique_ptr<TFile> file(TFile::Open(fileNames[fileIdx].c_str()));
+         auto tree = file ? static_cast<TTree *>(file->Get(treeName.c_str())) : nullptr;
+         if (tree) boundaries[fileIdx] = GetClusterBoundaries(*tree);
+      };
+      ROOT::TThreadExecutor pool;
+      pool.Foreach(readBoundaries, ROOT::TSeqU(fileNames.size()));
+      for (unsigned int fileIdx = 0; fileIdx < fileNames.size(); ++fileIdx) {
+         if (boundaries[fileIdx].empty()) {
+            const auto msg = "cannot read tree \"" + treeName + "\" from file \"" + fileNames[fileIdx] + "\"";
+            throw std::runtime_error(msg);
+         }
       }
+      return boundaries;
    }
 
-   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(V v, unsigned int slot)
+   /// \param[in] boundaries The cluster boundaries of each input file, as returned by GetClusterBoundaries
+   /// \param[in] nSlots The number of processing slots
+   /// \param[in] taskSize The number of entries per range. If 0, each slot gets about `fgRangesPerSlot` ranges.
+   TEntryRangeScheduler(const std::vector<std::vector<Long64_t>> &boundaries, unsigned int nSlots, Long64_t taskSize)
+      : fQueues(nSlots)
    {
-      fColls[slot]->emplace_back(v);
-   }
+      Long64_t nEntries = 0;
+      for (auto &fileBoundaries : boundaries) nEntries += fileBoundaries.back();
+      if (taskSize == 0) taskSize = std::max(nEntries / (nSlots * fgRangesPerSlot), Long64_t(1));
 
-   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(const V &vs, unsigned int slot)
-   {
-      auto thisColl = fColls[slot];
-      thisColl->insert(std::begin(thisColl), std::begin(vs), std::begin(vs));
+      std::vector<TEntryRange> ranges;
+      for (unsigned int fileIdx = 0; fileIdx < boundaries.size(); ++fileIdx)
+         SplitEntries(boundaries[fileIdx], fileIdx, taskSize, ranges);
+
+      // slot s owns the s-th contiguous block of ranges: neighbouring ranges are likely to be read by the same slot
+      for (std::size_t i = 0; i < ranges.size(); ++i) fQueues[i * nSlots / ranges.size()].fRanges.push_back(ranges[i]);
+      fNRanges = ranges.size();
    }
 
-   ~TakeOperation()
+   unsigned int GetNRanges() const { return fNRanges; }
+
+   /// Get the next range to be processed by a slot. Returns false when there is no work left.
+   bool GetNextRange(unsigned int slot, TEntryRange &range)
    {
-      unsigned int totSize = 0;
-      for (auto& coll : fColls) totSize += coll->size();
-      auto rColl = fColls[0];
-      rColl->reserve(totSize);
-      for (unsigned int i = 1; i < fColls.size(); ++i) {
-         auto& coll = fColls[i];
-         rColl->insert(rColl->end(), coll->begin(), coll->end());
+      {
+         auto &queue = fQueues[slot];
+         std::lock_guard<ROOT::TSpinMutex> lock(queue.fMutex);
+         if (!queue.fRanges.empty()) {
+            range = queue.fRanges.front();
+            queue.fRanges.pop_front();
+            return true;
+         }
+      }
+      // steal from the back of the queues of the other slots
+      const auto nSlots = fQueues.size();
+      for (unsigned int i = 1; i < nSlots; ++i) {
+         auto &victim = fQueues[(slot + i) % nSlots];
+         std::lock_guard<ROOT::TSpinMutex> lock(victim.fMutex);
+         if (!victim.fRanges.empty()) {
+            range = victim.fRanges.back();
+            victim.fRanges.pop_back();
+            return true;
+         }
       }
+      return false;
    }
 };
 
-class MinOperation {
-   double *fResultMin;
-   std::vector<double> fMins;
+using TVBPtr_t = std::shared_ptr<TTreeReaderValueBase>;
+using TVBVec_t = std::vector<TVBPtr_t>;
+
+/// The TTreeReaderArray of an array branch, and the view on it passed to filters, temporary branches and actions
+template <typename T>
+class TArrayBranchReader : public TTreeReaderArray<T> {
+   TArrayBranch<T> fView;
 
 public:
-   MinOperation(double *minVPtr, unsigned int nSlots)
-      : fResultMin(minVPtr), fMins(nSlots, std::numeric_limits<double>::max()) { }
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
-   {
-      fMins[slot] = std::min((double)v, fMins[slot]);
-   }
-   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(const T &vs, unsigned int slot)
-   {
-      for (auto &&v : vs) fMins[slot] = std::min((double)v, fMins[slot]);
-   }
-   ~MinOperation()
-   {
-      *fResultMin = std::numeric_limits<double>::max();
-      for (auto &m : fMins) *fResultMin = std::min(m, *fResultMin);
-   }
+   TArrayBranchReader(TTreeReader &r, const char *branchName) : TTreeReaderArray<T>(r, branchName), fView(*this) {}
+   TArrayBranch<T> &GetView() { return fView; }
 };
 
-class MaxOperation {
-   double *fResultMax;
-   std::vector<double> fMaxs;
+/// How the values of a branch of type T are read: through a TTreeReaderValue, or through a TTreeReaderArray
+/// for TArrayBranch. In batched mode the values of a block of entries are copied in an array: a TArrayBranch,
+/// a view on the values of the current entry only, cannot be.
+template <typename T>
+struct TBranchReader {
+   using Reader_t = TTreeReaderValue<T>;
+   static constexpr bool fgCanReadBlocks = true;
+   static T &GetValue(TTreeReaderValueBase *reader) { return **static_cast<Reader_t *>(reader); }
+};
 
-public:
-   MaxOperation(double *maxVPtr, unsigned int nSlots)
-      : fResultMax(maxVPtr), fMaxs(nSlots, std::numeric_limits<double>::min()) { }
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
-   {
-      fMaxs[slot] = std::max((double)v, fMaxs[slot]);
-   }
+template <typename T>
+struct TBranchReader<TArrayBranch<T>> {
+   using Reader_t = TArrayBranchReader<T>;
+   static constexpr bool fgCanReadBlocks = false;
+   static TArrayBranch<T> &GetValue(TTreeReaderValueBase *reader) { return static_cast<Reader_t *>(reader)->GetView(); }
+};
 
-   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(const T &vs, unsigned int slot)
-   {
-      for (auto &&v : vs) fMaxs[slot] = std::max((double)v, fMaxs[slot]);
-   }
+/// Whether columns of all these types can be read in blocks of entries
+constexpr bool CanReadBlocks(TDFTraitsUtils::TTypeList<>)
+{
+   return true;
+}
 
-   ~MaxOperation()
-   {
-      *fResultMax = std::numeric_limits<double>::min();
-      for (auto &m : fMaxs) {
-         *fResultMax = std::max(m, *fResultMax);
-      }
-   }
+template <typename T, typename... Ts>
+constexpr bool CanReadBlocks(TDFTraitsUtils::TTypeList<T, Ts...>)
+{
+   return TBranchReader<T>::fgCanReadBlocks && CanReadBlocks(TDFTraitsUtils::TTypeList<Ts...>());
+}
+
+/// In batched mode, copies the values of a real branch, entry by entry, in the array of the current block
+class TColumnReaderBase {
+public:
+   virtual ~TColumnReaderBase() {}
+   /// Copy the value of the current entry of the reader at the given position of the block
+   virtual void Load(unsigned int pos) = 0;
+   virtual const std::string &GetName() const = 0;
+   virtual const std::type_info &GetTypeId() const = 0;
 };
 
-class MeanOperation {
-   double *fResultMean;
-   std::vector<Count_t> fCounts;
-   std::vector<double> fSums;
+template <typename T>
+class TColumnReader final : public TColumnReaderBase {
+   const std::string fName;
+   TTreeReaderValue<T> fReaderValue;
+   TBlockValues<T> fValues;
 
 public:
-   MeanOperation(double *meanVPtr, unsigned int nSlots) : fResultMean(meanVPtr), fCounts(nSlots, 0), fSums(nSlots, 0) {}
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
-   {
-      fSums[slot] += v;
-      fCounts[slot] ++;
-   }
-
-   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(const T &vs, unsigned int slot)
-   {
-      for (auto &&v : vs) {
-         fSums[slot] += v;
-         fCounts[slot]++;
-      }
-   }
+   TColumnReader(TTreeReader &r, const std::string &name, unsigned int blockSize)
+      : fName(name), fReaderValue(r, name.c_str()), fValues(blockSize) { }
 
-   ~MeanOperation()
-   {
-      double sumOfSums = 0;
-      for (auto &s : fSums) sumOfSums += s;
-      Count_t sumOfCounts = 0;
-      for (auto &c : fCounts) sumOfCounts += c;
-      *fResultMean = sumOfSums / (sumOfCounts > 0 ? sumOfCounts : 1);
-   }
+   void Load(unsigned int pos) { fValues.Set(pos, *fReaderValue); }
+   const std::string &GetName() const { return fName; }
+   const std::type_info &GetTypeId() const { return typeid(T); }
+   T *GetValues() { return fValues.GetValues(); }
 };
 
-} // end of NS Operations
-
-enum class EActionType : short { kHisto1D, kMin, kMax, kMean };
+template <int... S, typename... BranchTypes>
+TVBVec_t BuildReaderValues(TTreeReader &r, const BranchNames &bl, const BranchNames &tmpbl,
+                           TDFTraitsUtils::TTypeList<BranchTypes...>,
+                           TDFTraitsUtils::TStaticSeq<S...>)
+{
+   // isTmpBranch has length bl.size(). Elements are true if the corresponding
+   // branch is a "fake" branch created with AddBranch, false if they are
+   // actual branches present in the TTree.
+   std::array<bool, sizeof...(S)> isTmpBranch;
+   for (unsigned int i = 0; i < isTmpBranch.size(); ++i)
+      isTmpBranch[i] = std::find(tmpbl.begin(), tmpbl.end(), bl.at(i)) != tmpbl.end();
 
-} // end NS Internal
+   // Build vector of pointers to TTreeReaderValueBase.
+   // tvb[i] points to a TTreeReaderValue specialized for the i-th BranchType (a TTreeReaderArray
+   // if it is a TArrayBranch), corresponding to the i-th branch in bl
+   // For temporary branches (declared with AddBranch) a nullptr is created instead
+   // S is expected to be a sequence of sizeof...(BranchTypes) integers
+   TVBVec_t tvb{isTmpBranch[S] ? nullptr : std::make_shared<typename TBranchReader<BranchTypes>::Reader_t>(
+                                            r, bl.at(S).c_str())...}; // "..." expands BranchTypes and S simultaneously
 
-namespace Details {
-// forward declarations for TDataFrameInterface
-template <typename F, typename PrevData>
-class TDataFrameFilter;
-template <typename F, typename PrevData>
-class TDataFrameBranch;
-class TDataFrameImpl;
+   return tvb;
 }
 
-/**
-* \class ROOT::TDataFrameInterface
-* \brief The public interface to the TDataFrame federation of classes: TDataFrameImpl, TDataFrameFilter, TDataFrameBranch
-* \tparam T One of the TDataFrameImpl, TDataFrameFilter, TDataFrameBranch classes. The user never specifies this type manually.
-*/
-template <typename Proxied>
-class TDataFrameInterface {
-   template<typename T> friend class TDataFrameInterface;
-public:
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Build the dataframe
-   /// \param[in] treeName Name of the tree contained in the directory
-   /// \param[in] dirPtr TDirectory where the tree is stored, e.g. a TFile.
-   /// \param[in] defaultBranches Collection of default branches.
-   ///
-   /// The default branches are looked at in case no branch is specified in the
-   /// booking of actions or transformations.
-   TDataFrameInterface(const std::string &treeName, TDirectory *dirPtr, const BranchNames &defaultBranches = {});
+using TmpBranchPtrVec_t = std::vector<Details::TDataFrameBranchBase *>;
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Build the dataframe
-   /// \param[in] tree The tree or chain to be studied.
-   /// \param[in] defaultBranches Collection of default branches.
-   ///
-   /// The default branches are looked at in case no branch is specified in the
-   /// booking of actions or transformations.
-   TDataFrameInterface(TTree &tree, const BranchNames &defaultBranches = {});
+// Forward declarations
+Details::TDataFrameBranchBase *GetTmpBranchPtr(Details::TDataFrameImpl &df, const std::string &branch,
+                                               const BranchNames &tmpbl, const std::type_info &type);
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Append a filter to the call graph.
-   /// \param[in] f Function, lambda expression, functor class or any other callable object. It must return a `bool` signalling whether the event has passed the selection (true) or not (false).
+template <int... S, typename... BranchTypes>
+TmpBranchPtrVec_t BuildTmpBranchPtrs(Details::TDataFrameImpl &df, const BranchNames &bl, const BranchNames &tmpbl,
+                                     TDFTraitsUtils::TTypeList<BranchTypes...>,
+                                     TDFTraitsUtils::TStaticSeq<S...>)
+{
+   // Resolve, once per slot and before the event loop, the temporary branches
+   // among the branches in bl. tbp[i] points to the TDataFrameBranch producing
+   // the i-th branch of bl, or is a nullptr if that is a real branch.
+   TmpBranchPtrVec_t tbp{GetTmpBranchPtr(df, bl.at(S), tmpbl, typeid(BranchTypes))...};
+   return tbp;
+}
+
+// Forward declarations
+template <typename T>
+T *GetColumnValues(Details::TDataFrameImpl &df, TTreeReader &r, unsigned int slot, const std::string &branch);
+
+/// The array the values of a real branch are copied in, block after block
+template <typename T, typename std::enable_if<TBranchReader<T>::fgCanReadBlocks, int>::type = 0>
+void *GetBlockColumn(Details::TDataFrameImpl &df, TTreeReader &r, unsigned int slot, const std::string &branch)
+{
+   return GetColumnValues<T>(df, r, slot, branch);
+}
+
+// graphs reading array branches are not processed in blocks
+template <typename T, typename std::enable_if<!TBranchReader<T>::fgCanReadBlocks, int>::type = 0>
+void *GetBlockColumn(Details::TDataFrameImpl &, TTreeReader &, unsigned int, const std::string &)
+{
+   return nullptr;
+}
+
+template <int... S, typename... BranchTypes>
+std::vector<void *> BuildBlockColumns(Details::TDataFrameImpl &df, TTreeReader &r, unsigned int slot,
+                                      const BranchNames &bl, const BranchNames &tmpbl,
+                                      TDFTraitsUtils::TTypeList<BranchTypes...>, TDFTraitsUtils::TStaticSeq<S...>)
+{
+   // the batched counterpart of BuildReaderValues: columns[i] points to the array holding the values of
+   // the i-th branch of bl in the current block, or is a nullptr if that is a temporary branch
+   std::array<bool, sizeof...(S)> isTmpBranch;
+   for (unsigned int i = 0; i < isTmpBranch.size(); ++i)
+      isTmpBranch[i] = std::find(tmpbl.begin(), tmpbl.end(), bl.at(i)) != tmpbl.end();
+   std::vector<void *> columns{isTmpBranch[S] ? nullptr : GetBlockColumn<BranchTypes>(df, r, slot, bl.at(S))...};
+   return columns;
+}
+
+/// The values of a column in a block, valid at least at the selected positions: the array of a real
+/// branch, or the values a temporary branch computes for the selected entries
+template <typename T>
+T *GetBlockValues(void *column, Details::TDataFrameBranchBase *tmpBranch, unsigned int slot, const TEntryBlock &block,
+                  const TBlockSelection_t &sel);
+
+/// Evaluate a filter on the selected entries of a block, writing the positions of those that pass to
+/// `passed`, which must have room for all of them. Returns the number of entries that passed.
+/// Positions are written unconditionally and kept by advancing the output, without branches.
+template <typename F, typename... Ts>
+std::size_t SelectBlock(F &f, const TBlockSelection_t &sel, unsigned int *passed, Ts *... vs)
+{
+   std::size_t nPassed = 0;
+   for (auto pos : sel) {
+      passed[nPassed] = pos;
+      nPassed += f(vs[pos]...);
+   }
+   return nPassed;
+}
+
+/// Call an action on the selected entries of a block: once, through its batch entry point if it has one...
+template <typename F, typename... Ts>
+auto CallOnBlock(int, F &f, unsigned int slot, const TBlockSelection_t &sel, Ts *... vs)
+   -> decltype(f.ExecBlock(slot, sel, vs...), void())
+{
+   f.ExecBlock(slot, sel, vs...);
+}
+
+/// ...otherwise once per selected entry
+template <typename F, typename... Ts>
+void CallOnBlock(long, F &f, unsigned int slot, const TBlockSelection_t &sel, Ts *... vs)
+{
+   for (std::size_t i = 0; i < sel.size(); ++i) f(slot, vs[sel[i]]...);
+}
+
+template <typename Filter>
+void CheckFilter(Filter f)
+{
+   using FilterRet_t = typename TDFTraitsUtils::TFunctionTraits<Filter>::RetType_t;
+   static_assert(std::is_same<FilterRet_t, bool>::value, "filter functions must return a bool");
+}
+
+void CheckTmpBranch(const std::string& branchName, TTree *treePtr)
+{
+   if (!treePtr) return; // cached columns: there is no tree
+   auto branch = treePtr->GetBranch(branchName.c_str());
+   if (branch != nullptr) {
+      auto msg = "branch \"" + branchName + "\" already present in TTree";
+      throw std::runtime_error(msg);
+   }
+}
+
+/// Append the real branches in bl, i.e. the ones not in tmpbl, to the read set, unless already there
+void AddRealBranches(const BranchNames &bl, const BranchNames &tmpbl, BranchNames &readSet)
+{
+   for (auto &branch : bl) {
+      if (std::find(tmpbl.begin(), tmpbl.end(), branch) == tmpbl.end() &&
+          std::find(readSet.begin(), readSet.end(), branch) == readSet.end())
+         readSet.emplace_back(branch);
+   }
+}
+
+/// The state of a tree changed by SetUpReadSet
+struct TTreeReadState {
+   std::vector<std::pair<std::string, bool>> fBranchStatus; ///< The status the top-level branches had before
+   bool fHasCreatedCache = false;                           ///< Whether the tree had no cache before
+};
+
+/// Only read the branches in the read set from the tree. If the tree has no cache, one is created
+/// that prefetches exactly those branches; a cache set up by the user is left as it is, and learns
+/// the branches that are read. Returns what has to be undone by RestoreReadState.
+TTreeReadState SetUpReadSet(TTree &tree, const BranchNames &readSet)
+{
+   TTreeReadState oldState;
+   for (auto branch : *tree.GetListOfBranches()) {
+      const auto name = branch->GetName();
+      oldState.fBranchStatus.emplace_back(name, tree.GetBranchStatus(name));
+   }
+   tree.SetBranchStatus("*", false);
+   for (auto &branch : readSet) tree.SetBranchStatus(branch.c_str(), true);
+   if (tree.GetCacheSize() == 0) {
+      tree.SetCacheSize();
+      for (auto &branch : readSet) tree.AddBranchToCache(branch.c_str(), true);
+      tree.StopCacheLearningPhase();
+      oldState.fHasCreatedCache = true;
+   }
+   return oldState;
+}
+
+void RestoreReadState(TTree &tree, const TTreeReadState &oldState)
+{
+   for (auto &status : oldState.fBranchStatus) tree.SetBranchStatus(status.first.c_str(), status.second);
+   if (oldState.fHasCreatedCache) tree.SetCacheSize(0);
+}
+
+/// Returns local BranchNames or default BranchNames according to which one should be used
+const BranchNames &PickBranchNames(unsigned int nArgs, const BranchNames &bl, const BranchNames &defBl)
+{
+   bool useDefBl = false;
+   if (nArgs != bl.size()) {
+      if (bl.size() == 0 && nArgs == defBl.size()) {
+         useDefBl = true;
+      } else {
+         auto msg = "mismatch between number of filter arguments (" + std::to_string(nArgs) +
+                    ") and number of branches (" + std::to_string(bl.size() ? bl.size() : defBl.size()) + ")";
+         throw std::runtime_error(msg);
+      }
+   }
+
+   return useDefBl ? defBl : bl;
+}
+
+class TDataFrameActionBase {
+public:
+   virtual ~TDataFrameActionBase() {}
+   virtual void Run(unsigned int slot, int entry) = 0;
+   /// Run the action on the entries of a block that pass all filters upstream of it
+   virtual void RunBlock(unsigned int slot, const TEntryBlock &block) = 0;
+   /// Run the action on the selected entries of a block, without checking the filters upstream of it
+   virtual void ExecuteBlock(unsigned int slot, const TEntryBlock &block, const TBlockSelection_t &sel) = 0;
+   /// The closest filter upstream of this action, nullptr if there is none
+   virtual Details::TDataFrameFilterBase *GetParentFilter() = 0;
+   /// Whether this action and all the nodes upstream of it can process blocks of entries
+   virtual bool CanProcessBlocks() const = 0;
+   virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
+   virtual void CreateSlots(unsigned int nSlots) = 0;
+   /// Let the nodes upstream know that an action depends on them
+   virtual void TriggerChildrenCount() = 0;
+   /// Add the real branches read by this action and by the nodes upstream of it to the read set
+   virtual void AddReadBranches(BranchNames &readSet) const = 0;
+   /// Add the time spent in this action during the last event loop, if profiled, to the profile
+   virtual void AddProfile(TDataFrameProfile &profile) const = 0;
+};
+
+using ActionBasePtr_t = std::shared_ptr<TDataFrameActionBase>;
+using ActionBaseVec_t = std::vector<ActionBasePtr_t>;
+
+// Forward declarations
+template <int S, typename T>
+T &GetBranchValue(TVBPtr_t &readerValue, Details::TDataFrameBranchBase *tmpBranch, unsigned int slot, int entry,
+                  TProfileCounters *loadCounters);
+
+template <typename F, typename PrevDataFrame>
+class TDataFrameAction final : public TDataFrameActionBase {
+   using BranchTypes_t = typename TDFTraitsUtils::TRemoveFirst<typename TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t>::Types_t;
+   using TypeInd_t = typename TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
+
+   F fAction;
+   const BranchNames fBranches;
+   const BranchNames fTmpBranches;
+   PrevDataFrame *fPrevData;
+   std::weak_ptr<Details::TDataFrameImpl> fFirstData;
+   std::vector<TVBVec_t> fReaderValues;
+   std::vector<std::vector<void *>> fBlockColumns; ///< The arrays of the real branches, in batched mode
+   std::vector<TmpBranchPtrVec_t> fTmpBranchPtrs;
+   ProfileStorage_t fProfileCounters;          ///< Empty unless the event loop is profiled
+   ProfileStorage_t *fLoadCounters = nullptr; ///< The reader loads of the data frame, if profiled
+
+public:
+   TDataFrameAction(F f, const BranchNames &bl, std::weak_ptr<PrevDataFrame> pd)
+      : fAction(f), fBranches(bl), fTmpBranches(pd.lock()->GetTmpBranches()), fPrevData(pd.lock().get()),
+        fFirstData(pd.lock()->GetDataFrame()) { }
+
+   TDataFrameAction(const TDataFrameAction &) = delete;
+
+   void Run(unsigned int slot, int entry)
+   {
+      // check if entry passes all filters
+      if (CheckFilters(slot, entry)) ExecuteAction(slot, entry);
+   }
+
+   bool CheckFilters(unsigned int slot, int entry)
+   {
+      // start the recursive chain of CheckFilters calls
+      return fPrevData->CheckFilters(slot, entry);
+   }
+
+   void ExecuteAction(unsigned int slot, int entry)
+   {
+      TProfileTimer timer(GetSlotCounters(fProfileCounters, slot));
+      ExecuteActionHelper(slot, entry, TypeInd_t(), BranchTypes_t());
+   }
+
+   void RunBlock(unsigned int slot, const TEntryBlock &block)
+   {
+      const auto &sel = fPrevData->CheckBlock(slot, block);
+      if (!sel.empty()) ExecuteBlock(slot, block, sel);
+   }
+
+   void ExecuteBlock(unsigned int slot, const TEntryBlock &block, const TBlockSelection_t &sel)
+   {
+      TProfileTimer timer(GetSlotCounters(fProfileCounters, slot), sel.size());
+      ExecuteBlockHelper(slot, block, sel, TypeInd_t(), BranchTypes_t());
+   }
+
+   bool CanProcessBlocks() const { return CanReadBlocks(BranchTypes_t()) && fPrevData->CanProcessBlocks(); }
+
+   Details::TDataFrameFilterBase *GetParentFilter() { return fPrevData->GetFilterAncestor(); }
+
+   void TriggerChildrenCount() { fPrevData->IncrChildrenCount(); }
+
+   void AddReadBranches(BranchNames &readSet) const
+   {
+      AddRealBranches(fBranches, fTmpBranches, readSet);
+      fPrevData->AddReadBranches(readSet);
+   }
+
+   void CreateSlots(unsigned int nSlots)
+   {
+      fReaderValues.resize(nSlots);
+      fBlockColumns.resize(nSlots);
+      fTmpBranchPtrs.resize(nSlots);
+      SetUpProfiling(*fFirstData.lock(), nSlots, fProfileCounters, fLoadCounters);
+   }
+
+   void AddProfile(TDataFrameProfile &profile) const
+   {
+      if (fProfileCounters.size() == 0) return;
+      const auto sum = SumCounters(fProfileCounters);
+      profile.AddNode("action", JoinNames(fBranches), sum.fNCalls, sum.fTime);
+   }
+
+   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+   {
+      auto df = fFirstData.lock();
+      if (GetLoopBatchSize(*df) > 0)
+         fBlockColumns[slot] =
+            ROOT::Internal::BuildBlockColumns(*df, r, slot, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      else
+         fReaderValues[slot] =
+            ROOT::Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      fTmpBranchPtrs[slot] =
+         ROOT::Internal::BuildTmpBranchPtrs(*df, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+   }
+
+   template <int... S, typename... BranchTypes>
+   void ExecuteActionHelper(unsigned int slot, int entry,
+                            TDFTraitsUtils::TStaticSeq<S...>,
+                            TDFTraitsUtils::TTypeList<BranchTypes...>)
+   {
+      // Take each pointer in tvb, cast it to a pointer to the
+      // correct specialization of TTreeReaderValue, and get its content.
+      // S expands to a sequence of integers 0 to sizeof...(types)-1
+      // S and types are expanded simultaneously by "..."
+      fAction(slot, GetBranchValue<S, BranchTypes>(fReaderValues[slot][S], fTmpBranchPtrs[slot][S], slot, entry,
+                                                   GetSlotCounters(fLoadCounters, slot))...);
+   }
+
+   template <int... S, typename... BranchTypes>
+   void ExecuteBlockHelper(unsigned int slot, const TEntryBlock &block, const TBlockSelection_t &sel,
+                           TDFTraitsUtils::TStaticSeq<S...>, TDFTraitsUtils::TTypeList<BranchTypes...>)
+   {
+      // the arrays of values of the columns are passed at once, with the positions of the selected entries
+      CallOnBlock(0, fAction, slot, sel,
+                  GetBlockValues<BranchTypes>(fBlockColumns[slot][S], fTmpBranchPtrs[slot][S], slot, block, sel)...);
+   }
+};
+
+namespace Operations {
+using namespace Internal::TDFTraitsUtils;
+using Count_t = unsigned long;
+
+class CountOperation {
+   unsigned int *fResultCount;
+   Internal::TSlotStorage<Count_t> fCounts;
+
+public:
+   CountOperation(unsigned int *resultCount, unsigned int nSlots) : fResultCount(resultCount), fCounts(nSlots, 0) {}
+
+   void Exec(unsigned int slot)
+   {
+      fCounts[slot]++;
+   }
+
+   /// Batch entry point: count the selected entries of a block
+   void ExecBlock(const TBlockSelection_t &sel, unsigned int slot)
+   {
+      fCounts[slot] += sel.size();
+   }
+
+   /// Sum the counts of the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, unsigned int &partial, TProgressMonitor &monitor)
+   {
+      partial = 0;
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         partial += fCounts[slot];
+      }
+   }
+
+   ~CountOperation()
+   {
+      *fResultCount = 0;
+      for (auto &c : fCounts) {
+         *fResultCount += c;
+      }
+   }
+};
+
+/// Fills the report of a chain of filters with their counters, once the event loop is over
+class ReportOperation {
+   TCutFlowReport *fReport;
+   const std::vector<Details::TDataFrameFilterBase *> fFilters; ///< The filters of the chain, the most upstream first
+
+public:
+   ReportOperation(TCutFlowReport *report, const std::vector<Details::TDataFrameFilterBase *> &filters)
+      : fReport(report), fFilters(filters) { }
+
+   // the filters count the entries themselves
+   void Exec(unsigned int) {}
+
+   ~ReportOperation();
+};
+
+/// Counts values in a fixed number of fine bins of width 2^k, aligned to the multiples of their width.
+/// When a value does not fit, the bins are moved, and made twice as wide as many times as needed by
+/// summing adjacent bins: memory does not grow with the number of values. The extremes and the sums of
+/// the values are kept exactly.
+class TRebinnableCounts {
+   static constexpr Long64_t fgNBins = 16384;
+
+   std::vector<double> fCounts; ///< Allocated when the first values are added
+   int fExponent = 0;           ///< The bins are 2^fExponent wide
+   Long64_t fFirst = 0;         ///< The first bin spans [fFirst * 2^fExponent, (fFirst + 1) * 2^fExponent)
+   double fMin = 0.;
+   double fMax = 0.;
+   double fSumX = 0.;
+   double fSumX2 = 0.;
+   ULong64_t fNValues = 0;       ///< Finite values
+   ULong64_t fNUnderflow = 0;    ///< Values equal to -inf
+   ULong64_t fNOverflow = 0;     ///< Values equal to +inf or nan
+
+   /// The index of the bin of x for bins 2^exponent wide. A double, as it may not fit in the bins yet.
+   static double BinOf(double x, int exponent) { return std::floor(std::ldexp(x, -exponent)); }
+
+   /// Move the bins so that they cover [min, max], and widen them if needed
+   void Relocate(double min, double max)
+   {
+      const auto magnitude = std::max(std::abs(min), std::abs(max));
+      auto exponent = fExponent;
+      if (fCounts.empty()) {
+         // a quarter of the bins span the first values, the others are room for the next ones
+         exponent = max > min ? std::ilogb((max - min) / (fgNBins / 4)) + 1
+                              : magnitude > 0. ? std::ilogb(magnitude) - 20 : 0;
+         fCounts.assign(fgNBins, 0.);
+      }
+      // bins finer than the resolution of the values would not be of any use, and their indices could overflow
+      if (magnitude > 0.) exponent = std::max(exponent, std::ilogb(magnitude) - 52);
+      while (BinOf(max, exponent) - BinOf(min, exponent) >= fgNBins) ++exponent;
+      const auto minBin = static_cast<Long64_t>(BinOf(min, exponent));
+      const auto span = static_cast<Long64_t>(BinOf(max, exponent)) - minBin + 1;
+      const auto first = minBin - (fgNBins - span) / 2;
+      if (exponent == fExponent && first == fFirst) return;
+      std::vector<double> counts(fgNBins, 0.);
+      for (Long64_t i = 0; i < fgNBins; ++i) {
+         if (fCounts[i] == 0.) continue;
+         const auto bin = static_cast<Long64_t>(std::floor(std::ldexp(double(fFirst + i), fExponent - exponent)));
+         counts[bin - first] += fCounts[i];
+      }
+      fCounts.swap(counts);
+      fExponent = exponent;
+      fFirst = first;
+   }
+
+public:
+   /// Count a block of values
+   void Add(const double *vs, std::size_t n)
+   {
+      auto min = fNValues > 0 ? fMin : std::numeric_limits<double>::max();
+      auto max = fNValues > 0 ? fMax : std::numeric_limits<double>::lowest();
+      ULong64_t nValues = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+         if (!std::isfinite(vs[i])) continue;
+         min = std::min(min, vs[i]);
+         max = std::max(max, vs[i]);
+         ++nValues;
+      }
+      if (nValues > 0) {
+         if (fCounts.empty() || BinOf(min, fExponent) < fFirst || BinOf(max, fExponent) >= fFirst + fgNBins)
+            Relocate(min, max);
+         fMin = min;
+         fMax = max;
+      }
+      for (std::size_t i = 0; i < n; ++i) {
+         const auto v = vs[i];
+         if (std::isfinite(v)) {
+            fCounts[static_cast<Long64_t>(BinOf(v, fExponent)) - fFirst] += 1.;
+            fSumX += v;
+            fSumX2 += v * v;
+         } else if (v < 0.) {
+            ++fNUnderflow;
+         } else {
+            ++fNOverflow;
+         }
+      }
+      fNValues += nValues;
+   }
+
+   /// Add the counted values to a histogram. Each value is counted in the bin of the centre of its
+   /// fine bin, or of the nearest extreme of the values if that centre is beyond them. The statistics
+   /// of the histogram take into account the exact values, if its axis extends to include all of them.
+   void FillHistogram(TH1F &h) const
+   {
+      std::array<double, TH1::kNstat> stats;
+      stats.fill(0.);
+      h.GetStats(stats.data());
+      const auto width = std::ldexp(1., fExponent);
+      auto addToBin = [&h](int bin, double count) {
+         h.AddBinContent(bin, count);
+         if (h.GetSumw2N() > 0) h.GetSumw2()->AddAt(h.GetSumw2()->At(bin) + count, bin);
+      };
+      for (Long64_t i = 0; fNValues > 0 && i < fgNBins; ++i) {
+         if (fCounts[i] == 0.) continue;
+         const auto centre = (fFirst + i + 0.5) * width;
+         addToBin(h.FindBin(std::min(std::max(centre, fMin), fMax)), fCounts[i]);
+      }
+      if (fNUnderflow > 0) addToBin(0, fNUnderflow);
+      if (fNOverflow > 0) addToBin(h.GetNbinsX() + 1, fNOverflow);
+      if (h.CanExtendAllAxes()) {
+         stats[0] += fNValues;
+         stats[1] += fNValues;
+         stats[2] += fSumX;
+         stats[3] += fSumX2;
+         h.PutStats(stats.data());
+      }
+      h.SetEntries(h.GetEntries() + fNValues + fNUnderflow + fNOverflow);
+   }
+};
+
+/// Fills a histogram with automatic axis limits. The slots buffer the values they process; the limits
+/// of the axis are only known at the end of the event loop, when the buffers are filled in the histogram.
+/// A slot whose buffer is full moves its values to fine bins of its own (TRebinnableCounts) and reuses
+/// the buffer, so that memory does not grow with the number of entries. The values moved to fine bins
+/// are filled at the centre of their fine bin, i.e. within 1/4096 of the range of the values of the slot.
+class FillOperation {
+   // this sets a total size of 16 MB for the buffers
+   static constexpr unsigned int fgTotalBufSize = 2097152;
+   using BufEl_t = double;
+   using Buf_t = std::vector<BufEl_t>;
+
+   Internal::TSlotStorage<Buf_t> fBuffers;
+   Internal::TSlotStorage<TRebinnableCounts> fCounts;
+   std::shared_ptr<TH1F> fResultHist;
+   unsigned int fBufSize;
+   Internal::TSlotStorage<BufEl_t> fMin;
+   Internal::TSlotStorage<BufEl_t> fMax;
+
+   template <typename T>
+   void UpdateMinMax(unsigned int slot, T v) {
+      auto& thisMin = fMin[slot];
+      auto& thisMax = fMax[slot];
+      thisMin = std::min(thisMin, (BufEl_t)v);
+      thisMax = std::max(thisMax, (BufEl_t)v);
+   }
+
+   template <typename T>
+   void Push(T v, unsigned int slot)
+   {
+      UpdateMinMax(slot, v);
+      auto &buf = fBuffers[slot];
+      if (buf.size() == fBufSize) {
+         fCounts[slot].Add(buf.data(), buf.size());
+         buf.clear();
+      }
+      buf.emplace_back(v);
+   }
+
+public:
+   FillOperation(std::shared_ptr<TH1F> h, unsigned int nSlots) : fBuffers(nSlots),
+                                                                 fCounts(nSlots),
+                                                                 fResultHist(h),
+                                                                 fBufSize (fgTotalBufSize / nSlots),
+                                                                 fMin(nSlots, std::numeric_limits<BufEl_t>::max()),
+                                                                 fMax(nSlots, std::numeric_limits<BufEl_t>::lowest())
+   {
+      for (auto &buf : fBuffers) buf.reserve(fBufSize);
+   }
+
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      Push(v, slot);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      for (auto& v : vs) {
+         Push(v, slot);
+      }
+   }
+
+   /// Batch entry point: buffer the values of the selected entries of a block, updating the extremes of
+   /// the slot once per block
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void ExecBlock(const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+   {
+      auto thisMin = fMin[slot];
+      auto thisMax = fMax[slot];
+      auto &buf = fBuffers[slot];
+      for (auto pos : sel) {
+         const BufEl_t v = vs[pos];
+         thisMin = std::min(thisMin, v);
+         thisMax = std::max(thisMax, v);
+         if (buf.size() == fBufSize) {
+            fCounts[slot].Add(buf.data(), buf.size());
+            buf.clear();
+         }
+         buf.emplace_back(v);
+      }
+      fMin[slot] = thisMin;
+      fMax[slot] = thisMax;
+   }
+
+   /// Fill a copy of the (empty) result histogram with the values of the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, TH1F &partial, TProgressMonitor &monitor)
+   {
+      partial = *fResultHist;
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         auto &buf = fBuffers[slot];
+         partial.FillN(buf.size(), buf.data(), nullptr);
+         fCounts[slot].FillHistogram(partial);
+      }
+   }
+
+   ~FillOperation()
+   {
+
+      BufEl_t globalMin = *std::min_element(fMin.begin(), fMin.end());
+      BufEl_t globalMax = *std::max_element(fMax.begin(), fMax.end());
+
+      if (fResultHist->CanExtendAllAxes() &&
+          globalMin != std::numeric_limits<BufEl_t>::max() &&
+          globalMax != std::numeric_limits<BufEl_t>::lowest()) {
+         auto xaxis = fResultHist->GetXaxis();
+         fResultHist->ExtendAxis(globalMin, xaxis);
+         fResultHist->ExtendAxis(globalMax, xaxis);
+      }
+
+      for (auto& buf : fBuffers) {
+         fResultHist->FillN(buf.size(), buf.data(), nullptr);
+      }
+      for (auto &counts : fCounts) {
+         counts.FillHistogram(*fResultHist);
+      }
+   }
+};
+
+
+/// Whether FillFixedBins can fill the histogram: fixed-width bins that do not extend, and neither
+/// buffer, axis range nor statistics of the overflows that would make TH1::Fill take another path
+bool CanFillFixedBins(const TH1F &h)
+{
+   const auto xaxis = h.GetXaxis();
+   return !h.GetBuffer() && !h.CanExtendAllAxes() && !xaxis->IsVariableBinSize() &&
+          !xaxis->TestBit(TAxis::kAxisRange) && !TH1::GetStatOverflows();
+}
+
+/// Fill a one-dimensional histogram with unit weights, with the same results as calling TH1::Fill for
+/// each value. For each block of values, the bins are computed first, with the arithmetic of
+/// TAxis::FindBin, in a loop without calls or branches: compilers vectorise it unless they must
+/// preserve floating point traps (gcc needs -fno-trapping-math). Then contents, sums of weights and
+/// moments are accumulated in the order of the values, as TH1::Fill would.
+/// The histogram must satisfy CanFillFixedBins.
+template <typename T>
+void FillFixedBins(TH1F &h, const T *vs, std::size_t n)
+{
+   constexpr std::size_t blockSize = 256;
+   const auto xaxis = h.GetXaxis();
+   const auto nBins = xaxis->GetNbins();
+   const auto xMin = xaxis->GetXmin();
+   const auto xMax = xaxis->GetXmax();
+   auto contents = h.GetArray();
+   auto sumw2 = h.GetSumw2N() > 0 ? h.GetSumw2() : nullptr;
+   std::array<double, TH1::kNstat> stats;
+   stats.fill(0.);
+   h.GetStats(stats.data());
+   int bins[blockSize];
+   for (std::size_t begin = 0; begin < n; begin += blockSize) {
+      const auto size = std::min(blockSize, n - begin);
+      const auto block = vs + begin;
+      for (std::size_t i = 0; i < size; ++i) {
+         const double x = block[i];
+         const bool isUnderflow = x < xMin;
+         const bool isOverflow = !(x < xMax); // nan too, as in TAxis::FindBin
+         // values out of the axis are replaced before the conversion, which they could overflow
+         const double inAxis = isUnderflow | isOverflow ? xMin : x;
+         const int bin = 1 + int(nBins * (inAxis - xMin) / (xMax - xMin));
+         bins[i] = isUnderflow ? 0 : isOverflow ? nBins + 1 : bin;
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+         const auto bin = bins[i];
+         ++contents[bin];
+         if (sumw2) ++sumw2->fArray[bin];
+         if (bin == 0 || bin > nBins) continue;
+         const double x = block[i];
+         ++stats[0];
+         ++stats[1];
+         stats[2] += x;
+         stats[3] += x * x;
+      }
+   }
+   h.PutStats(stats.data());
+   h.SetEntries(h.GetEntries() + n);
+}
+
+/// Fill a one-dimensional histogram with a block of values with unit weights
+void FillBlock(TH1F &h, const double *vs, std::size_t n)
+{
+   if (CanFillFixedBins(h))
+      FillFixedBins(h, vs, n);
+   else
+      h.FillN(n, vs, nullptr);
+}
+
+/// Fill a histogram with each value of a collection, with unit weights
+template <typename HIST, typename T>
+void FillCollection(HIST &h, const T &vs)
+{
+   for (auto &v : vs) h.Fill(v);
+}
+
+void FillCollection(TH1F &h, const std::vector<double> &vs)
+{
+   FillBlock(h, vs.data(), vs.size());
+}
+
+void FillCollection(TH1F &h, const std::vector<float> &vs)
+{
+   if (CanFillFixedBins(h))
+      FillFixedBins(h, vs.data(), vs.size());
+   else
+      for (auto v : vs) h.Fill(v);
+}
+
+/// The number of values of a column in an entry: 0 if the column is not a collection
+template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+std::size_t GetNValues(const T &)
+{
+   return 0;
+}
+
+template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+std::size_t GetNValues(const T &vs)
+{
+   return vs.size();
+}
+
+/// The i-th value of a column in an entry: the value itself if the column is not a collection
+template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+const T &GetValueAt(const T &v, std::size_t)
+{
+   return v;
+}
+
+template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+auto GetValueAt(const T &vs, std::size_t i) -> decltype(*std::begin(vs))
+{
+   return *std::next(std::begin(vs), i);
+}
+
+template <typename T>
+const T &GetValueAt(const TArrayBranch<T> &vs, std::size_t i)
+{
+   return vs[i];
+}
+
+/// Fills a histogram or profile of any dimension: every slot fills its own copy, and the copies are
+/// merged at the end of the event loop. In batched mode one-dimensional histograms are filled with
+/// the values of the selected entries of a block at once.
+template <typename HIST = TH1F>
+class FillTOOperation {
+   TThreadedObject<HIST> fTo;
+   Internal::TSlotStorage<std::vector<double>> fBlockValues; ///< The selected values of the current block
+
+   /// Fill with one value per column, i.e. one point
+   template <typename... Ts>
+   static void FillPoint(HIST &h, std::size_t, std::false_type, const Ts &... vs)
+   {
+      h.Fill(vs...);
+   }
+
+   /// Fill with a point per element of the collection columns: scalar columns are repeated for each point
+   template <typename... Ts>
+   static void FillPoint(HIST &h, std::size_t nPoints, std::true_type, const Ts &... vs)
+   {
+      for (std::size_t i = 0; i < nPoints; ++i) h.Fill(GetValueAt(vs, i)...);
+   }
+
+public:
+
+   FillTOOperation(std::shared_ptr<HIST> h, unsigned int nSlots) : fTo(*h), fBlockValues(nSlots)
+   {
+      fTo.SetAtSlot(0, h);
+      // Initialise all other slots
+      for (unsigned int i = 0 ; i < nSlots; ++i) {
+         fTo.GetAtSlot(i);
+      }
+   }
+
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fTo.GetAtSlotUnchecked(slot)->Fill(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      FillCollection(*fTo.GetAtSlotUnchecked(slot), vs);
+   }
+
+   /// Batch entry point: gather the values of the selected entries of a block, then fill them in one go
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void ExecBlock(const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+   {
+      auto &values = fBlockValues[slot];
+      values.resize(sel.size());
+      for (std::size_t i = 0; i < sel.size(); ++i) values[i] = vs[sel[i]];
+      FillCollection(*fTo.GetAtSlotUnchecked(slot), values);
+   }
+
+   /// Fill with several columns, e.g. the coordinates of a point followed by a weight. If some of the
+   /// columns are collections, all of them must have the same size in each entry.
+   template <typename T0, typename T1, typename... Ts>
+   void Exec(unsigned int slot, const T0 &v0, const T1 &v1, const Ts &... vs)
+   {
+      const bool isCollection[] = {TIsContainer<T0>::fgValue, TIsContainer<T1>::fgValue, TIsContainer<Ts>::fgValue...};
+      const std::size_t sizes[] = {GetNValues(v0), GetNValues(v1), GetNValues(vs)...};
+      std::size_t nPoints = 0;
+      bool hasPoints = false;
+      for (std::size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+         if (!isCollection[i]) continue;
+         if (hasPoints && sizes[i] != nPoints)
+            throw std::runtime_error("Cannot fill a histogram with collections of different sizes");
+         nPoints = sizes[i];
+         hasPoints = true;
+      }
+      using HasCollections_t = std::integral_constant<bool, TIsAnyContainer<T0, T1, Ts...>::fgValue>;
+      FillPoint(*fTo.GetAtSlotUnchecked(slot), nPoints, HasCollections_t(), v0, v1, vs...);
+   }
+
+   /// Merge the histograms of the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, HIST &partial, TProgressMonitor &monitor)
+   {
+      bool isFirst = true;
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         auto &slotHist = *fTo.GetAtSlotUnchecked(slot);
+         if (isFirst)
+            partial = slotHist;
+         else
+            partial.Add(&slotHist);
+         isFirst = false;
+      }
+   }
+
+   ~FillTOOperation()
+   {
+      fTo.Merge();
+   }
+
+};
+
+// note: changes to this class should probably be replicated in its partial
+// specializations below
+template<typename T, typename COLL>
+class TakeOperation {
+   std::shared_ptr<COLL> fResultColl;
+   Internal::TSlotStorage<COLL> fColls;
+public:
+   TakeOperation(std::shared_ptr<COLL> resultColl, unsigned int nSlots) : fResultColl(resultColl), fColls(nSlots) {}
+
+   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue ||
+                                                 std::is_same<V, typename COLL::value_type>::value, int>::type = 0>
+   void Exec(const V &v, unsigned int slot)
+   {
+      fColls[slot].emplace_back(v);
+   }
+
+   /// The values of the collection are appended at once
+   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue &&
+                                                 !std::is_same<V, typename COLL::value_type>::value, int>::type = 0>
+   void Exec(const V &vs, unsigned int slot)
+   {
+      auto &thisColl = fColls[slot];
+      thisColl.insert(std::end(thisColl), std::begin(vs), std::end(vs));
+   }
+
+   ~TakeOperation()
+   {
+      auto &rColl = *fResultColl;
+      rColl = std::move(fColls[0]);
+      for (unsigned int i = 1; i < fColls.size(); ++i) {
+         auto &coll = fColls[i];
+         rColl.insert(std::end(rColl), std::make_move_iterator(std::begin(coll)),
+                      std::make_move_iterator(std::end(coll)));
+      }
+   }
+};
+
+// note: changes to this class should probably be replicated in its unspecialized
+// declaration above
+template<typename T, typename U>
+class TakeOperation<T, std::vector<U>> {
+   std::shared_ptr<std::vector<U>> fResultColl;
+   Internal::TSlotStorage<std::vector<U>> fColls;
+public:
+   TakeOperation(std::shared_ptr<std::vector<U>> resultColl, unsigned int nSlots)
+      : fResultColl(resultColl), fColls(nSlots)
+   {
+      for (auto &coll : fColls) coll.reserve(1024);
+   }
+
+   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue || std::is_same<V, U>::value, int>::type = 0>
+   void Exec(const V &v, unsigned int slot)
+   {
+      fColls[slot].emplace_back(v);
+   }
+
+   /// The values of the collection are appended at once
+   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue && !std::is_same<V, U>::value, int>::type = 0>
+   void Exec(const V &vs, unsigned int slot)
+   {
+      auto &thisColl = fColls[slot];
+      thisColl.insert(thisColl.end(), std::begin(vs), std::end(vs));
+   }
+
+   /// The collections of the slots are moved to the result, allocated once, in parallel
+   ~TakeOperation()
+   {
+      auto &rColl = *fResultColl;
+      if (fColls.size() == 1)
+         rColl = std::move(fColls[0]);
+      else
+         Internal::AppendChunks(rColl, fColls, true);
+   }
+};
+
+// note: changes to this class should probably be replicated in its unspecialized
+// declaration above
+template<typename T, typename U>
+class TakeOperation<T, TChunkedVector<U>> {
+   std::shared_ptr<TChunkedVector<U>> fResultColl;
+   Internal::TSlotStorage<std::vector<U>> fColls;
+public:
+   TakeOperation(std::shared_ptr<TChunkedVector<U>> resultColl, unsigned int nSlots)
+      : fResultColl(resultColl), fColls(nSlots)
+   {
+      for (auto &coll : fColls) coll.reserve(1024);
+   }
+
+   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue || std::is_same<V, U>::value, int>::type = 0>
+   void Exec(const V &v, unsigned int slot)
+   {
+      fColls[slot].emplace_back(v);
+   }
+
+   /// The values of the collection are appended at once
+   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue && !std::is_same<V, U>::value, int>::type = 0>
+   void Exec(const V &vs, unsigned int slot)
+   {
+      auto &thisColl = fColls[slot];
+      thisColl.insert(thisColl.end(), std::begin(vs), std::end(vs));
+   }
+
+   /// The collections of the slots become the chunks of the result, without copies
+   ~TakeOperation()
+   {
+      std::vector<std::vector<U>> chunks;
+      chunks.reserve(fColls.size());
+      for (auto &coll : fColls) chunks.emplace_back(std::move(coll));
+      *fResultColl = TChunkedVector<U>(std::move(chunks));
+   }
+};
+
+class MinOperation {
+   double *fResultMin;
+   Internal::TSlotStorage<double> fMins;
+
+public:
+   MinOperation(double *minVPtr, unsigned int nSlots)
+      : fResultMin(minVPtr), fMins(nSlots, std::numeric_limits<double>::max()) { }
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fMins[slot] = std::min((double)v, fMins[slot]);
+   }
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      for (auto &&v : vs) fMins[slot] = std::min((double)v, fMins[slot]);
+   }
+   /// Batch entry point: the minimum of the selected entries of a block
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void ExecBlock(const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+   {
+      auto thisMin = fMins[slot];
+      for (auto pos : sel) thisMin = std::min((double)vs[pos], thisMin);
+      fMins[slot] = thisMin;
+   }
+   /// The minimum of the values seen by the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, double &partial, TProgressMonitor &monitor)
+   {
+      partial = std::numeric_limits<double>::max();
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         partial = std::min(fMins[slot], partial);
+      }
+   }
+
+   ~MinOperation()
+   {
+      *fResultMin = std::numeric_limits<double>::max();
+      for (auto &m : fMins) *fResultMin = std::min(m, *fResultMin);
+   }
+};
+
+class MaxOperation {
+   double *fResultMax;
+   Internal::TSlotStorage<double> fMaxs;
+
+public:
+   MaxOperation(double *maxVPtr, unsigned int nSlots)
+      : fResultMax(maxVPtr), fMaxs(nSlots, std::numeric_limits<double>::lowest()) { }
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fMaxs[slot] = std::max((double)v, fMaxs[slot]);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      for (auto &&v : vs) fMaxs[slot] = std::max((double)v, fMaxs[slot]);
+   }
+
+   /// Batch entry point: the maximum of the selected entries of a block
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void ExecBlock(const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+   {
+      auto thisMax = fMaxs[slot];
+      for (auto pos : sel) thisMax = std::max((double)vs[pos], thisMax);
+      fMaxs[slot] = thisMax;
+   }
+
+   /// The maximum of the values seen by the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, double &partial, TProgressMonitor &monitor)
+   {
+      partial = std::numeric_limits<double>::lowest();
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         partial = std::max(fMaxs[slot], partial);
+      }
+   }
+
+   ~MaxOperation()
+   {
+      *fResultMax = std::numeric_limits<double>::lowest();
+      for (auto &m : fMaxs) {
+         *fResultMax = std::max(m, *fResultMax);
+      }
+   }
+};
+
+class MeanOperation {
+   double *fResultMean;
+   Internal::TSlotStorage<Count_t> fCounts;
+   Internal::TSlotStorage<double> fSums;
+
+public:
+   MeanOperation(double *meanVPtr, unsigned int nSlots) : fResultMean(meanVPtr), fCounts(nSlots, 0), fSums(nSlots, 0) {}
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fSums[slot] += v;
+      fCounts[slot] ++;
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      for (auto &&v : vs) {
+         fSums[slot] += v;
+         fCounts[slot]++;
+      }
+   }
+
+   /// Batch entry point: add the selected entries of a block to the sum of the slot
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void ExecBlock(const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+   {
+      auto thisSum = fSums[slot];
+      for (auto pos : sel) thisSum += vs[pos];
+      fSums[slot] = thisSum;
+      fCounts[slot] += sel.size();
+   }
+
+   /// The mean of the values seen by the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, double &partial, TProgressMonitor &monitor)
+   {
+      double sum = 0;
+      Count_t count = 0;
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         sum += fSums[slot];
+         count += fCounts[slot];
+      }
+      partial = sum / (count > 0 ? count : 1);
+   }
+
+   ~MeanOperation()
+   {
+      double sumOfSums = 0;
+      for (auto &s : fSums) sumOfSums += s;
+      Count_t sumOfCounts = 0;
+      for (auto &c : fCounts) sumOfCounts += c;
+      *fResultMean = sumOfSums / (sumOfCounts > 0 ? sumOfCounts : 1);
+   }
+};
+
+/// Accumulates the statistics of the values seen by each slot, merged at the end of the event loop
+class StatsOperation {
+   TStatistics *fResultStats;
+   Internal::TSlotStorage<TStatistics> fStats;
+
+public:
+   StatsOperation(TStatistics *resultStats, unsigned int nSlots) : fResultStats(resultStats), fStats(nSlots) {}
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fStats[slot].Fill(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      auto &thisStats = fStats[slot];
+      for (auto &&v : vs) thisStats.Fill(v);
+   }
+
+   /// The statistics of the values seen by the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, TStatistics &partial, TProgressMonitor &monitor)
+   {
+      partial = TStatistics();
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         partial.Merge(fStats[slot]);
+      }
+   }
+
+   ~StatsOperation()
+   {
+      TStatistics stats;
+      for (auto &s : fStats) stats.Merge(s);
+      *fResultStats = stats;
+   }
+};
+
+/// A KLL sketch (Karnin, Lang, Liberty, 2016) of the distribution of a set of values, from which approximate
+/// quantiles are extracted. Values are kept in levels: a value at level h stands for 2^h values. When the
+/// sketch is full, the lowest level over its capacity is sorted, and every other value, starting from the first
+/// or the second at random, is moved to the level above; the others are discarded. Capacities decrease
+/// geometrically, by a factor 2/3, from k at the highest level, so that the sketch holds less than 3k values
+/// plus a few per level whatever the number of values. Sketches are merged by concatenating their levels and
+/// compacting again: merged sketches are as accurate as one filled with all the values.
+/// The extremes are kept exactly; nan values are ignored.
+class TQuantileSketch {
+   static constexpr std::size_t fgMinCapacity = 8;
+
+   std::size_t fK;
+   std::vector<std::vector<double>> fLevels;
+   std::vector<std::size_t> fCapacities; ///< The capacity of each level, updated when levels are added
+   std::size_t fTotalCapacity = 0;
+   std::size_t fSize = 0; ///< The number of values in all levels
+   ULong64_t fN = 0;
+   double fMin = std::numeric_limits<double>::max();
+   double fMax = std::numeric_limits<double>::lowest();
+   std::minstd_rand fRandom;
+
+   /// Levels get smaller the deeper they are below the top one
+   void UpdateCapacities()
+   {
+      fCapacities.resize(fLevels.size());
+      fTotalCapacity = 0;
+      for (std::size_t level = 0; level < fLevels.size(); ++level) {
+         const auto depth = fLevels.size() - 1 - level;
+         const auto capacity = static_cast<std::size_t>(std::ceil(fK * std::pow(2. / 3., depth)));
+         fCapacities[level] = std::max(std::size_t(fgMinCapacity), capacity);
+         fTotalCapacity += fCapacities[level];
+      }
+   }
+
+   /// Halve the lowest level over its capacity
+   void Compact()
+   {
+      for (std::size_t level = 0; level < fLevels.size(); ++level) {
+         if (fLevels[level].size() < fCapacities[level]) continue;
+         if (level + 1 == fLevels.size()) {
+            fLevels.emplace_back();
+            UpdateCapacities();
+         }
+         auto &values = fLevels[level];
+         auto &next = fLevels[level + 1];
+         std::sort(values.begin(), values.end());
+         // with an odd number of values, the largest stays at this level
+         const auto nCompacted = values.size() - values.size() % 2;
+         for (auto i = static_cast<std::size_t>(fRandom() % 2); i < nCompacted; i += 2) next.emplace_back(values[i]);
+         values.erase(values.begin(), values.begin() + nCompacted);
+         fSize -= nCompacted / 2;
+         return;
+      }
+   }
+
+public:
+   /// The capacity k needed for a rank error of at most accuracy * N, with a probability of 99%, as measured
+   /// for this kind of sketch by the authors of the DataSketches library: accuracy = 2.296 / k^0.9723
+   static std::size_t GetCapacityForAccuracy(double accuracy)
+   {
+      const auto k = static_cast<std::size_t>(std::ceil(std::pow(2.296 / accuracy, 1. / 0.9723)));
+      return std::max(std::size_t(fgMinCapacity), k);
+   }
+
+   TQuantileSketch(std::size_t k = 200) : fK(k), fLevels(1) { UpdateCapacities(); }
+
+   void Fill(double v)
+   {
+      if (std::isnan(v)) return;
+      fLevels[0].emplace_back(v);
+      ++fSize;
+      ++fN;
+      if (v < fMin) fMin = v;
+      if (v > fMax) fMax = v;
+      if (fSize >= fTotalCapacity) Compact();
+   }
+
+   void Merge(const TQuantileSketch &other)
+   {
+      if (other.fLevels.size() > fLevels.size()) {
+         fLevels.resize(other.fLevels.size());
+         UpdateCapacities();
+      }
+      for (std::size_t level = 0; level < other.fLevels.size(); ++level) {
+         const auto &values = other.fLevels[level];
+         fLevels[level].insert(fLevels[level].end(), values.begin(), values.end());
+      }
+      fSize += other.fSize;
+      fN += other.fN;
+      if (other.fMin < fMin) fMin = other.fMin;
+      if (other.fMax > fMax) fMax = other.fMax;
+      while (fSize >= fTotalCapacity) Compact();
+   }
+
+   /// The smallest value of the sketch whose weighted rank is at least q * N, for each quantile q in [0, 1].
+   /// 0 and 1 give the exact minimum and maximum; all quantiles are nan if there are no values.
+   std::vector<double> GetQuantiles(const std::vector<double> &qs) const
+   {
+      std::vector<std::pair<double, ULong64_t>> weighted;
+      weighted.reserve(fSize);
+      for (std::size_t level = 0; level < fLevels.size(); ++level)
+         for (auto v : fLevels[level]) weighted.emplace_back(v, ULong64_t(1) << level);
+      std::sort(weighted.begin(), weighted.end());
+      std::vector<ULong64_t> ranks(weighted.size());
+      ULong64_t rank = 0;
+      for (std::size_t i = 0; i < weighted.size(); ++i) ranks[i] = rank += weighted[i].second;
+
+      std::vector<double> quantiles;
+      quantiles.reserve(qs.size());
+      for (auto q : qs) {
+         if (fN == 0) {
+            quantiles.emplace_back(std::numeric_limits<double>::quiet_NaN());
+         } else if (q <= 0.) {
+            quantiles.emplace_back(fMin);
+         } else if (q >= 1.) {
+            quantiles.emplace_back(fMax);
+         } else {
+            const auto target = static_cast<ULong64_t>(std::ceil(q * fN));
+            const auto it = std::lower_bound(ranks.begin(), ranks.end(), target);
+            quantiles.emplace_back(it != ranks.end() ? weighted[it - ranks.begin()].first : fMax);
+         }
+      }
+      return quantiles;
+   }
+};
+
+/// Fills one TQuantileSketch per slot, merged at the end of the event loop
+class QuantilesOperation {
+   std::shared_ptr<std::vector<double>> fResultQuantiles;
+   const std::vector<double> fQs;
+   const std::size_t fK;
+   Internal::TSlotStorage<TQuantileSketch> fSketches;
+
+public:
+   QuantilesOperation(std::shared_ptr<std::vector<double>> resultQuantiles, const std::vector<double> &qs,
+                      std::size_t k, unsigned int nSlots)
+      : fResultQuantiles(resultQuantiles), fQs(qs), fK(k), fSketches(nSlots, TQuantileSketch(k)) {}
+
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fSketches[slot].Fill(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      auto &thisSketch = fSketches[slot];
+      for (auto &&v : vs) thisSketch.Fill(v);
+   }
+
+   /// The quantiles of the values seen by the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, std::vector<double> &partial, TProgressMonitor &monitor)
+   {
+      TQuantileSketch sketch(fK);
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         sketch.Merge(fSketches[slot]);
+      }
+      partial = sketch.GetQuantiles(fQs);
+   }
+
+   ~QuantilesOperation()
+   {
+      auto &sketch = *fSketches.begin();
+      for (auto it = ++fSketches.begin(); it != fSketches.end(); ++it) sketch.Merge(*it);
+      *fResultQuantiles = sketch.GetQuantiles(fQs);
+   }
+};
+
+/// Update an accumulator with a user function: in place if the function returns void, otherwise
+/// by assigning its return value
+template <typename F, typename Acc, typename V>
+void UpdateAccumulator(std::true_type /*returnsVoid*/, F &f, Acc &acc, const V &v)
+{
+   f(acc, v);
+}
+
+template <typename F, typename Acc, typename V>
+void UpdateAccumulator(std::false_type /*returnsVoid*/, F &f, Acc &acc, const V &v)
+{
+   acc = f(acc, v);
+}
+
+/// Keeps an accumulator per slot, updated with the values of a branch. At the end of the event loop
+/// the accumulators are merged pairwise in log2(nSlots) rounds: the merges of a round run in parallel.
+template <typename Acc, typename AccF, typename MergeF>
+class AggregateOperation {
+   using AccReturnsVoid_t = std::is_void<typename TFunctionTraits<AccF>::RetType_t>;
+   using MergeReturnsVoid_t = std::is_void<typename TFunctionTraits<MergeF>::RetType_t>;
+
+   AccF fAccumulate;
+   MergeF fMerge;
+   std::shared_ptr<Acc> fResult;
+   Internal::TSlotStorage<Acc> fAccs;
+
+public:
+   AggregateOperation(AccF accumulate, MergeF merge, std::shared_ptr<Acc> result, unsigned int nSlots)
+      : fAccumulate(accumulate), fMerge(merge), fResult(result), fAccs(nSlots, *result) { }
+
+   template <typename T>
+   void Exec(const T &v, unsigned int slot)
+   {
+      UpdateAccumulator(AccReturnsVoid_t(), fAccumulate, fAccs[slot], v);
+   }
+
+   /// Merge the accumulators of the slots while the event loop runs
+   void MergePartial(const std::vector<unsigned int> &slots, Acc &partial, TProgressMonitor &monitor)
+   {
+      partial = *fResult;
+      for (auto slot : slots) {
+         const auto lock = monitor.LockSlot(slot);
+         UpdateAccumulator(MergeReturnsVoid_t(), fMerge, partial, fAccs[slot]);
+      }
+   }
+
+   ~AggregateOperation()
+   {
+      const auto nSlots = fAccs.size();
+      for (unsigned int stride = 1; stride < nSlots; stride *= 2) {
+         // slot i absorbs slot i + stride, for the multiples i of 2 * stride
+         const unsigned int nMerges = (nSlots - stride + 2 * stride - 1) / (2 * stride);
+         auto mergePair = [this, stride](unsigned int k) {
+            const auto slot = 2 * stride * k;
+            UpdateAccumulator(MergeReturnsVoid_t(), fMerge, fAccs[slot], fAccs[slot + stride]);
+         };
+#ifdef R__USE_IMT
+         if (ROOT::IsImplicitMTEnabled() && nMerges > 1) {
+            ROOT::TThreadExecutor pool;
+            pool.Foreach(mergePair, ROOT::TSeqU(nMerges));
+            continue;
+         }
+#endif // R__USE_IMT
+         for (unsigned int k = 0; k < nMerges; ++k) mergePair(k);
+      }
+      if (nSlots > 0) *fResult = std::move(fAccs[0]);
+   }
+};
+
+/// Writes the values of a set of branches to a new TTree.
+/// In single-thread runs the tree is written directly to the output file.
+/// In multi-thread runs each slot fills a tree of its own in an in-memory file, where its baskets are
+/// serialized and compressed independently of the other slots; every fgEntriesPerWrite entries (and
+/// at the end of the event loop) the content of the in-memory file is handed to a TBufferMerger, which
+/// appends it to the output file. Slots only synchronize when handing over a buffer, never per entry.
+template <typename... BranchTypes>
+class SnapshotOperation {
+   static constexpr ULong64_t fgEntriesPerWrite = 32768;
+   using Addresses_t = std::array<const void *, sizeof...(BranchTypes)>;
+
+   struct TSlotOutput {
+      std::shared_ptr<TFile> fFile;
+      TTree *fTree = nullptr;                       ///< Owned by this object, stored in fFile
+      std::tuple<BranchTypes...> fPlaceholders;     ///< What the output branches read from until the first entry
+      Addresses_t fAddresses{{}};                   ///< Addresses the output branches currently read from
+      ULong64_t fNUnwritten = 0;                    ///< Entries filled since the last write to the merger
+   };
+
+   const BranchNames fBranchNames;
+   std::unique_ptr<ROOT::Experimental::TBufferMerger> fMerger; ///< nullptr in single-thread runs
+   // declared after fMerger: the files of the slots must be destroyed before the merger
+   Internal::TSlotStorage<TSlotOutput> fOutputs;
+
+   /// Create all the output branches of a slot, so that the tree has them even if no entry is written
+   template <int... S>
+   void CreateBranches(TSlotOutput &output, TStaticSeq<S...>)
+   {
+      int expander[] = {(output.fTree->Branch(fBranchNames[S].c_str(), &std::get<S>(output.fPlaceholders)),
+                         output.fAddresses[S] = &std::get<S>(output.fPlaceholders), 0)...,
+                        0};
+      (void)expander;
+   }
+
+   template <typename T>
+   void UpdateBranch(TSlotOutput &output, unsigned int i, T &value)
+   {
+      // values can move, e.g. when a new file is read: output branches follow them
+      if (output.fAddresses[i] == &value) return;
+      output.fTree->SetBranchAddress(fBranchNames[i].c_str(), &value);
+      output.fAddresses[i] = &value;
+   }
+
+   template <int... S>
+   void UpdateBranches(TSlotOutput &output, TStaticSeq<S...>, BranchTypes &... values)
+   {
+      // expand the parameter packs in an array initializer: UpdateBranch is called for each branch, in order
+      int expander[] = {(UpdateBranch(output, S, values), 0)..., 0};
+      (void)expander;
+   }
+
+public:
+   SnapshotOperation(const std::string &treeName, const std::string &fileName, const BranchNames &bl,
+                     unsigned int nSlots)
+      : fBranchNames(bl), fOutputs(nSlots)
+   {
+      // restore the current directory when done: files and trees are created in it
+      TDirectory::TContext ctxt;
+      if (nSlots > 1)
+         fMerger.reset(new ROOT::Experimental::TBufferMerger(fileName.c_str(), "RECREATE"));
+      for (auto &output : fOutputs) {
+         if (fMerger)
+            output.fFile = fMerger->GetFile();
+         else
+            output.fFile = std::make_shared<TFile>(fileName.c_str(), "RECREATE");
+         output.fFile->cd();
+         output.fTree = new TTree(treeName.c_str(), treeName.c_str());
+         CreateBranches(output, typename TGenStaticSeq<sizeof...(BranchTypes)>::Type_t());
+      }
+   }
+
+   void Exec(unsigned int slot, BranchTypes &... values)
+   {
+      auto &output = fOutputs[slot];
+      UpdateBranches(output, typename TGenStaticSeq<sizeof...(BranchTypes)>::Type_t(), values...);
+      output.fTree->Fill();
+      if (fMerger && ++output.fNUnwritten == fgEntriesPerWrite) {
+         output.fFile->Write();
+         output.fNUnwritten = 0;
+      }
+   }
+
+   ~SnapshotOperation()
+   {
+      for (auto &output : fOutputs) {
+         output.fFile->Write();
+         delete output.fTree;
+         output.fFile->Close();
+      }
+   }
+};
+
+/// Copies the values of a set of branches in memory, in one contiguous array per branch.
+/// Each slot appends the values it processes to buffers of its own; at the end of the event loop
+/// the buffers of all slots are moved, in slot order, into the arrays of the cached columns.
+/// Values are move-constructed in the arrays, which are not initialised beforehand, and each buffer
+/// releases its memory as it is emptied: at most a block of each buffer is held twice.
+template <typename... BranchTypes>
+class CacheOperation {
+   using Buffers_t = std::tuple<std::deque<BranchTypes>...>;
+   using Columns_t = std::tuple<std::shared_ptr<Details::TDataFrameCachedColumn<BranchTypes>>...>;
+   using TypeInd_t = typename TGenStaticSeq<sizeof...(BranchTypes)>::Type_t;
+
+   Columns_t fColumns;
+   std::shared_ptr<TCacheStatus> fStatus;
+   Internal::TSlotStorage<Buffers_t> fBuffers;
+
+   template <int... S>
+   void Push(Buffers_t &buffers, TStaticSeq<S...>, BranchTypes &... values)
+   {
+      int expander[] = {(std::get<S>(buffers).push_back(values), 0)..., 0};
+      (void)expander;
+   }
+
+   template <int S>
+   int FillColumn()
+   {
+      auto &column = std::get<S>(fColumns);
+      column->Reserve(fStatus->fNEntries);
+      for (auto &buffers : fBuffers) {
+         auto &buffer = std::get<S>(buffers);
+         while (!buffer.empty()) {
+            column->Append(std::move(buffer.front()));
+            buffer.pop_front();
+         }
+         buffer.shrink_to_fit();
+      }
+      return 0;
+   }
+
+   template <int... S>
+   void FillColumns(TStaticSeq<S...>)
+   {
+      int expander[] = {FillColumn<S>()..., 0};
+      (void)expander;
+   }
+
+   template <int... S>
+   static Columns_t CreateColumns(const BranchNames &bl, TStaticSeq<S...>)
+   {
+      return Columns_t(std::make_shared<Details::TDataFrameCachedColumn<BranchTypes>>(bl[S])...);
+   }
+
+   template <int... S>
+   std::vector<std::shared_ptr<Details::TDataFrameBranchBase>> GetColumns(TStaticSeq<S...>) const
+   {
+      return {std::get<S>(fColumns)...};
+   }
+
+public:
+   CacheOperation(const BranchNames &bl, const std::shared_ptr<TCacheStatus> &status, unsigned int nSlots)
+      : fColumns(CreateColumns(bl, TypeInd_t())), fStatus(status), fBuffers(nSlots)
+   {
+   }
+
+   /// The columns filled by this operation, in the order of the branch names it was built with
+   std::vector<std::shared_ptr<Details::TDataFrameBranchBase>> GetColumns() const { return GetColumns(TypeInd_t()); }
+
+   void Exec(unsigned int slot, BranchTypes &... values) { Push(fBuffers[slot], TypeInd_t(), values...); }
+
+   ~CacheOperation()
+   {
+      ULong64_t nEntries = 0;
+      for (auto &buffers : fBuffers) nEntries += std::get<0>(buffers).size();
+      fStatus->fNEntries = nEntries;
+      FillColumns(TypeInd_t());
+      fStatus->fIsFilled = true;
+   }
+};
+
+/// Calls an operation on the value of a column in an entry and, in batched mode, on the values of the
+/// selected entries of a block: through the batch entry point of the operation if it has one for
+/// columns of type T, otherwise once per selected entry
+template <typename Op, typename T>
+class TOperationCaller {
+   std::shared_ptr<Op> fOp;
+
+   template <typename O>
+   static auto CallExecBlock(int, O &op, const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+      -> decltype(op.ExecBlock(vs, sel, slot), void())
+   {
+      op.ExecBlock(vs, sel, slot);
+   }
+
+   template <typename O>
+   static void CallExecBlock(long, O &op, const T *vs, const TBlockSelection_t &sel, unsigned int slot)
+   {
+      for (auto pos : sel) op.Exec(vs[pos], slot);
+   }
+
+public:
+   explicit TOperationCaller(const std::shared_ptr<Op> &op) : fOp(op) {}
+   void operator()(unsigned int slot, const T &v) { fOp->Exec(v, slot); }
+   void ExecBlock(unsigned int slot, const TBlockSelection_t &sel, const T *vs)
+   {
+      CallExecBlock(0, *fOp, vs, sel, slot);
+   }
+};
+
+/// Operations that read no column, e.g. Count
+template <typename Op>
+class TOperationCaller<Op, void> {
+   std::shared_ptr<Op> fOp;
+
+public:
+   explicit TOperationCaller(const std::shared_ptr<Op> &op) : fOp(op) {}
+   void operator()(unsigned int slot) { fOp->Exec(slot); }
+   void ExecBlock(unsigned int slot, const TBlockSelection_t &sel) { fOp->ExecBlock(sel, slot); }
+};
+
+} // end of NS Operations
+
+enum class EActionType : short { kHisto1D, kMin, kMax, kMean, kStats, kQuantiles };
+
+} // end NS Internal
+
+namespace Details {
+// forward declarations for TDataFrameInterface
+template <typename F, typename PrevData>
+class TDataFrameFilter;
+template <typename F, typename PrevData>
+class TDataFrameBranch;
+template <typename PrevData>
+class TDataFrameRange;
+class TDataFrameImpl;
+class TDataFrameFilterBase;
+}
+
+/**
+* \class ROOT::TDataFrameInterface
+* \brief The public interface to the TDataFrame federation of classes: TDataFrameImpl, TDataFrameFilter, TDataFrameBranch
+* \tparam T One of the TDataFrameImpl, TDataFrameFilter, TDataFrameBranch classes. The user never specifies this type manually.
+*/
+template <typename Proxied>
+class TDataFrameInterface {
+   template<typename T> friend class TDataFrameInterface;
+public:
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Build the dataframe
+   /// \param[in] treeName Name of the tree contained in the directory
+   /// \param[in] dirPtr TDirectory where the tree is stored, e.g. a TFile.
+   /// \param[in] defaultBranches Collection of default branches.
+   ///
+   /// The default branches are looked at in case no branch is specified in the
+   /// booking of actions or transformations.
+   TDataFrameInterface(const std::string &treeName, TDirectory *dirPtr, const BranchNames &defaultBranches = {});
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Build the dataframe
+   /// \param[in] tree The tree or chain to be studied.
+   /// \param[in] defaultBranches Collection of default branches.
+   ///
+   /// The default branches are looked at in case no branch is specified in the
+   /// booking of actions or transformations.
+   TDataFrameInterface(TTree &tree, const BranchNames &defaultBranches = {});
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Build the dataframe
+   /// \param[in] treeName Name of the tree contained in the files
+   /// \param[in] fileNameGlob Name of the input file, or a pattern matching the names of several input files.
+   /// \param[in] defaultBranches Collection of default branches.
+   ///
+   /// The files are chained in a TChain. When running in parallel, the clusters
+   /// of all files are processed concurrently.
+   TDataFrameInterface(const std::string &treeName, const std::string &fileNameGlob,
+                       const BranchNames &defaultBranches = {});
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Build the dataframe
+   /// \param[in] treeName Name of the tree contained in the files
+   /// \param[in] fileNameGlobs Collection of file names or of patterns matching file names.
+   /// \param[in] defaultBranches Collection of default branches.
+   ///
+   /// The files are chained in a TChain. When running in parallel, the clusters
+   /// of all files are processed concurrently.
+   TDataFrameInterface(const std::string &treeName, const std::vector<std::string> &fileNameGlobs,
+                       const BranchNames &defaultBranches = {});
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Append a filter to the call graph.
+   /// \param[in] f Function, lambda expression, functor class or any other callable object. It must return a `bool` signalling whether the event has passed the selection (true) or not (false).
    /// \param[in] bl Names of the branches in input to the filter function.
+   /// \param[in] name Optional name of the filter, shown in reports.
+   ///
+   /// Append a filter node at the point of the call graph corresponding to the
+   /// object this method is called on.
+   /// The callable `f` should not have side-effects (e.g. modification of an
+   /// external or static variable) to ensure correct results when implicit
+   /// multi-threading is active.
+   ///
+   /// TDataFrame only evaluates filters when necessary: if multiple filters
+   /// are chained one after another, they are executed in order and the first
+   /// one returning false causes the event to be discarded.
+   /// Even if multiple actions or transformations depend on the same filter,
+   /// it is executed once per entry. If its result is requested more than
+   /// once, the cached result is served.
+   template <typename F>
+   TDataFrameInterface<Details::TDataFrameFilter<F, Proxied>>
+   Filter(F f, const BranchNames &bl = {}, const std::string &name = "")
+   {
+      ROOT::Internal::CheckFilter(f);
+      auto df = GetDataFrameChecked();
+      const BranchNames &defBl = df->GetDefaultBranches();
+      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
+      const BranchNames &actualBl = Internal::PickBranchNames(nArgs, bl, defBl);
+      using DFF_t = Details::TDataFrameFilter<F, Proxied>;
+      auto FilterPtr = std::make_shared<DFF_t> (f, actualBl, fProxiedPtr, name);
+      TDataFrameInterface<DFF_t> tdf_f(FilterPtr);
+      df->Book(FilterPtr);
+      return tdf_f;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Append a range to the call graph.
+   /// \param[in] begin Number of the first entry, among those reaching this node, that passes the range.
+   /// \param[in] end Number of the entry, among those reaching this node, at which the range ends (excluded). 0 means no upper bound.
+   /// \param[in] stride Let one entry every `stride` through. Must be greater than 0.
+   ///
+   /// Entries are counted among those that reach the range, i.e. that pass all
+   /// the preceding filters: `d.Filter(f).Range(10)` selects the first ten
+   /// entries passing `f`. Once all the actions booked so far cannot receive
+   /// entries anymore because of the ranges upstream of them, the event loop
+   /// stops early.
+   /// In parallel runs the entries are counted in the order they are processed
+   /// by the worker threads, which is not necessarily the order in the data-set,
+   /// and each entry reaching the range increments a counter shared by all threads.
+   TDataFrameInterface<Details::TDataFrameRange<Proxied>> Range(ULong64_t begin, ULong64_t end,
+                                                                unsigned int stride = 1)
+   {
+      if (stride == 0 || (end != 0 && end < begin)) {
+         throw std::runtime_error("Range: stride must be strictly greater than 0 and end must be greater than begin.");
+      }
+      auto df = GetDataFrameChecked();
+      using Range_t = Details::TDataFrameRange<Proxied>;
+      auto rangePtr = std::make_shared<Range_t>(begin, end, stride, fProxiedPtr);
+      TDataFrameInterface<Range_t> tdf_r(rangePtr);
+      df->Book(rangePtr);
+      return tdf_r;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Append a range to the call graph, letting through the first `end` entries reaching it.
+   /// \param[in] end Number of the entry, among those reaching this node, at which the range ends (excluded).
+   ///
+   /// See the other Range overload for details.
+   TDataFrameInterface<Details::TDataFrameRange<Proxied>> Range(ULong64_t end) { return Range(0, end, 1); }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Creates a temporary branch
+   /// \param[in] name The name of the temporary branch.
+   /// \param[in] expression Function, lambda expression, functor class or any other callable object producing the temporary value. Returns the value that will be assigned to the temporary branch.
+   /// \param[in] bl Names of the branches in input to the producer function.
+   ///
+   /// Create a temporary branch that will be visible from all subsequent nodes
+   /// of the functional chain. The `expression` is only evaluated for entries that pass
+   /// all the preceding filters.
+   /// A new variable is created called `name`, accessible as if it was contained
+   /// in the dataset from subsequent transformations/actions.
+   ///
+   /// Use cases include:
+   ///
+   /// * caching the results of complex calculations for easy and efficient multiple access
+   /// * extraction of quantities of interest from complex objects
+   /// * branch aliasing, i.e. changing the name of a branch
+   ///
+   /// An exception is thrown if the name of the new branch is already in use
+   /// for another branch in the TTree.
+   template <typename F>
+   TDataFrameInterface<Details::TDataFrameBranch<F, Proxied>>
+   AddBranch(const std::string &name, F expression, const BranchNames &bl = {})
+   {
+      auto df = GetDataFrameChecked();
+      ROOT::Internal::CheckTmpBranch(name, df->GetTree());
+      const BranchNames &defBl = df->GetDefaultBranches();
+      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
+      const BranchNames &actualBl = Internal::PickBranchNames(nArgs, bl, defBl);
+      using DFB_t = Details::TDataFrameBranch<F, Proxied>;
+      auto BranchPtr = std::make_shared<DFB_t>(name, expression, actualBl, fProxiedPtr);
+      TDataFrameInterface<DFB_t> tdf_b(BranchPtr);
+      df->Book(BranchPtr);
+      return tdf_b;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Execute a user-defined function on each entry (*instant action*)
+   /// \param[in] f Function, lambda expression, functor class or any other callable object performing user defined calculations.
+   /// \param[in] bl Names of the branches in input to the user function.
+   ///
+   /// The callable `f` is invoked once per entry. This is an *instant action*:
+   /// upon invocation, an event loop as well as execution of all scheduled actions
+   /// is triggered.
+   /// Users are responsible for the thread-safety of this callable when executing
+   /// with implicit multi-threading enabled (i.e. ROOT::EnableImplicitMT).
+   template <typename F>
+   void Foreach(F f, const BranchNames &bl = {})
+   {
+      namespace IU = Internal::TDFTraitsUtils;
+      using ArgTypes_t = typename IU::TFunctionTraits<decltype(f)>::ArgTypesNoDecay_t;
+      using RetType_t = typename IU::TFunctionTraits<decltype(f)>::RetType_t;
+      auto fWithSlot = IU::AddSlotParameter<RetType_t>(f, ArgTypes_t());
+      ForeachSlot(fWithSlot, bl);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Execute a user-defined function requiring a processing slot index on each entry (*instant action*)
+   /// \param[in] f Function, lambda expression, functor class or any other callable object performing user defined calculations.
+   /// \param[in] bl Names of the branches in input to the user function.
+   ///
+   /// Same as `Foreach`, but the user-defined function takes an extra
+   /// `unsigned int` as its first parameter, the *processing slot index*.
+   /// This *slot index* will be assigned a different value, `0` to `poolSize - 1`,
+   /// for each thread of execution.
+   /// This is meant as a helper in writing thread-safe `Foreach`
+   /// actions when using `TDataFrame` after `ROOT::EnableImplicitMT()`.
+   /// The user-defined processing callable is able to follow different
+   /// *streams of processing* indexed by the first parameter.
+   /// `ForeachSlot` works just as well with single-thread execution: in that
+   /// case `slot` will always be `0`.
+   template<typename F>
+   void ForeachSlot(F f, const BranchNames &bl = {}) {
+      auto df = GetDataFrameChecked();
+      const BranchNames &defBl= df->GetDefaultBranches();
+      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
+      const BranchNames &actualBl = Internal::PickBranchNames(nArgs-1, bl, defBl);
+      using DFA_t  = Internal::TDataFrameAction<decltype(f), Proxied>;
+      df->Book(std::make_shared<DFA_t>(f, actualBl, fProxiedPtr));
+      df->Run();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Write the selected branches to a new tree (*instant action*)
+   /// \tparam BranchTypes Types of the branches to be written.
+   /// \param[in] treeName Name of the output tree.
+   /// \param[in] fileName Name of the output file, which is recreated.
+   /// \param[in] bl Names of the branches to be written, real or temporary ones (see AddBranch).
+   /// \return A new TDataFrame on the output tree, with `bl` as default branches.
+   ///
+   /// Only the entries that pass the filters upstream of this node are written.
+   /// Each branch keeps its name in the output tree. This is an *instant action*:
+   /// upon invocation, an event loop as well as execution of all scheduled actions
+   /// is triggered.
+   /// When running in parallel, each processing slot serializes and compresses
+   /// its entries in buffers of its own, which are then merged in the output file:
+   /// the order of the entries in the output tree is not guaranteed.
+   template <typename... BranchTypes>
+   TDataFrameInterface<Details::TDataFrameImpl>
+   Snapshot(const std::string &treeName, const std::string &fileName, const BranchNames &bl)
+   {
+      if (bl.size() != sizeof...(BranchTypes)) {
+         throw std::runtime_error("Snapshot: the number of branch names and of branch types must be the same.");
+      }
+      auto df = GetDataFrameChecked();
+      {
+         using Op_t = Internal::Operations::SnapshotOperation<BranchTypes...>;
+         auto snapshotOp = std::make_shared<Op_t>(treeName, fileName, bl, df->GetNSlots());
+         auto snapshotAction = [snapshotOp](unsigned int slot, BranchTypes &... values) {
+            snapshotOp->Exec(slot, values...);
+         };
+         using DFA_t = Internal::TDataFrameAction<decltype(snapshotAction), Proxied>;
+         df->Book(std::make_shared<DFA_t>(snapshotAction, bl, fProxiedPtr));
+      }
+      // the booked action holds the only reference to the operation: the output file is
+      // completed when the action is destroyed, at the end of the event loop
+      df->Run();
+      return TDataFrameInterface<Details::TDataFrameImpl>(treeName, fileName, bl);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Keep the values of the selected branches in memory
+   /// \tparam BranchTypes Types of the branches to be cached.
+   /// \param[in] bl Names of the branches to be cached, real or temporary ones (see AddBranch).
+   /// \return A new TDataFrame on the cached columns, with `bl` as default branches.
+   ///
+   /// Only the entries that pass the filters upstream of this node are cached.
+   /// The cached columns are filled by the first event loop run by this data
+   /// frame, or by the one returned. Event loops run by the returned data frame
+   /// then read contiguous arrays in memory rather than the TTree, and in
+   /// multi-thread runs slots process ranges of entry indexes.
+   /// Only the cached columns can be used downstream of the cache. When filled
+   /// in parallel, the order of the cached entries is not guaranteed.
+   template <typename... BranchTypes>
+   TDataFrameInterface<Details::TDataFrameImpl> Cache(const BranchNames &bl)
+   {
+      static_assert(sizeof...(BranchTypes) > 0, "Cache: at least one branch type must be specified");
+      if (bl.size() != sizeof...(BranchTypes)) {
+         throw std::runtime_error("Cache: the number of branch names and of branch types must be the same.");
+      }
+      auto df = GetDataFrameChecked();
+      auto status = std::make_shared<Internal::TCacheStatus>();
+      using Op_t = Internal::Operations::CacheOperation<BranchTypes...>;
+      auto cacheOp = std::make_shared<Op_t>(bl, status, df->GetNSlots());
+      auto cachedDf = std::make_shared<Details::TDataFrameImpl>(df, status, cacheOp->GetColumns());
+      cachedDf->SetFirstData(cachedDf);
+      auto cacheAction = [cacheOp](unsigned int slot, BranchTypes &... values) { cacheOp->Exec(slot, values...); };
+      using DFA_t = Internal::TDataFrameAction<decltype(cacheAction), Proxied>;
+      df->Book(std::make_shared<DFA_t>(cacheAction, bl, fProxiedPtr));
+      return TDataFrameInterface<Details::TDataFrameImpl>(cachedDf);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the number of entries processed (*lazy action*)
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   TActionResultProxy<unsigned int> Count()
+   {
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto cShared = std::make_shared<unsigned int>(0);
+      auto c = df->MakeActionResultPtr(cShared);
+      auto cPtr = cShared.get();
+      auto cOp = std::make_shared<Internal::Operations::CountOperation>(cPtr, nSlots);
+      Internal::Operations::TOperationCaller<Internal::Operations::CountOperation, void> countAction(cOp);
+      BranchNames bl = {};
+      using DFA_t = Internal::TDataFrameAction<decltype(countAction), Proxied>;
+      df->Book(std::shared_ptr<DFA_t>(new DFA_t(countAction, bl, fProxiedPtr)));
+      df->SetPartialMerger(cPtr, cOp);
+      return c;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the statistics of the filters upstream of this node (*lazy action*)
+   ///
+   /// For each filter of the chain leading to this node, the report lists its
+   /// name, if it was given one, the number of entries that reached it, the
+   /// number that passed it, and the cumulative efficiency with respect to
+   /// the first filter of the chain. The filters count the entries they
+   /// evaluate in per-slot counters, merged at the end of the event loop: a
+   /// single report replaces a Count after every filter. Filters included in
+   /// a report are evaluated in declaration order, even if
+   /// SetFilterReordering was called.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   TActionResultProxy<TCutFlowReport> Report()
+   {
+      auto df = GetDataFrameChecked();
+      std::vector<Details::TDataFrameFilterBase *> filters;
+      for (auto filter = fProxiedPtr->GetFilterAncestor(); filter; filter = filter->GetParentFilter()) {
+         filter->SetReported();
+         filters.insert(filters.begin(), filter);
+      }
+      auto rShared = std::make_shared<TCutFlowReport>();
+      auto r = df->MakeActionResultPtr(rShared);
+      auto rOp = std::make_shared<Internal::Operations::ReportOperation>(rShared.get(), filters);
+      auto reportAction = [rOp](unsigned int slot) { rOp->Exec(slot); };
+      BranchNames bl = {};
+      using DFA_t = Internal::TDataFrameAction<decltype(reportAction), Proxied>;
+      df->Book(std::make_shared<DFA_t>(reportAction, bl, fProxiedPtr));
+      return r;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return a collection of values of a branch (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \tparam COLL The type of collection used to store the values.
+   /// \param[in] branchName The name of the branch of which the values are to be collected
+   ///
+   /// Each processing slot fills a collection of its own. With a TChunkedVector as COLL, these collections
+   /// are the result, without copies; with a std::vector, they are moved to a single vector, allocated once,
+   /// in parallel if implicit multi-threading is enabled.
+   /// If T is a collection and the values of COLL are not, e.g. `Take<std::vector<float>, std::vector<float>>`,
+   /// the values of all collections are concatenated.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T, typename COLL = std::vector<T>>
+   TActionResultProxy<COLL> Take(const std::string &branchName = "")
+   {
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "get the values of the branch");
+      auto valuesPtr = std::make_shared<COLL>();
+      auto values = df->MakeActionResultPtr(valuesPtr);
+      auto getOp = std::make_shared<Internal::Operations::TakeOperation<T,COLL>>(valuesPtr, nSlots);
+      Internal::Operations::TOperationCaller<Internal::Operations::TakeOperation<T, COLL>, T> getAction(getOp);
+      BranchNames bl = {theBranchName};
+      using DFA_t = Internal::TDataFrameAction<decltype(getAction), Proxied>;
+      df->Book(std::shared_ptr<DFA_t>(new DFA_t(getAction, bl, fProxiedPtr)));
+      return values;
+   }
+
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional histogram with the values of a branch (*lazy action*)
+   /// \tparam T The type of the branch the values of which are used to fill the histogram.
+   /// \param[in] branchName The name of the branch of which the values are to be collected.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   /// The returned histogram is independent of the input one.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<TH1F> Histo(const std::string &branchName, const TH1F &model)
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "fill the histogram");
+      auto h = std::make_shared<TH1F>(model);
+      return CreateAction<T, Internal::EActionType::kHisto1D>(theBranchName, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional histogram with the values of a branch (*lazy action*)
+   /// \tparam T The type of the branch the values of which are used to fill the histogram.
+   /// \param[in] branchName The name of the branch of which the values are to be collected.
+   /// \param[in] nbins The number of bins.
+   /// \param[in] minVal The lower value of the xaxis.
+   /// \param[in] maxVal The upper value of the xaxis.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// If no axes boundaries are specified, the axis spans the minimum and maximum of
+   /// the values. Up to 2M values are buffered and filled exactly at the end of the loop
+   /// on the entries; when the buffers are full, their values are counted in a fixed
+   /// number of fine bins and filled at the centre of their fine bin. Memory does not
+   /// grow with the number of entries, and the statistics of the histogram (mean,
+   /// standard deviation) stay exact. If the axis boundaries are specified, the histogram (or histograms in the
+   /// parallel case) are filled directly.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<TH1F> Histo(const std::string &branchName = "", int nBins = 128, double minVal = 0.,
+                                double maxVal = 0.)
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "fill the histogram");
+      auto h = std::make_shared<TH1F>("", "", nBins, minVal, maxVal);
+      if (minVal == maxVal) {
+         h->SetCanExtend(TH1::kAllAxes);
+      }
+      return CreateAction<T, Internal::EActionType::kHisto1D>(theBranchName, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional histogram with the weighted values of a branch (*lazy action*)
+   /// \tparam V The type of the branch of the values.
+   /// \tparam W The type of the branch of the weights.
+   /// \param[in] vName The name of the branch of the values.
+   /// \param[in] wName The name of the branch of the weights.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// The types of the branches are not guessed: they are `double` unless specified.
+   /// If one of the branches is a collection, e.g. `Histo<std::vector<double>, double>`,
+   /// each of its elements is filled; the elements of collection branches are paired,
+   /// and must be as many in each entry. Every processing slot fills its own copy of
+   /// the histogram, and the copies are merged at the end of the event loop.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V = double, typename W = double>
+   TActionResultProxy<TH1F> Histo(const std::string &vName, const std::string &wName, const TH1F &model)
+   {
+      return BookFill<TH1F, V, W>(std::make_shared<TH1F>(model), {vName, wName});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a two-dimensional histogram (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the values on the y axis.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the values on the y axis.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double>
+   TActionResultProxy<TH2F> Histo2D(const std::string &v1Name, const std::string &v2Name, const TH2F &model)
+   {
+      return BookFill<TH2F, V1, V2>(std::make_shared<TH2F>(model), {v1Name, v2Name});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a weighted two-dimensional histogram (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the values on the y axis.
+   /// \tparam W The type of the branch of the weights.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the values on the y axis.
+   /// \param[in] wName The name of the branch of the weights.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double, typename W = double>
+   TActionResultProxy<TH2F> Histo2D(const std::string &v1Name, const std::string &v2Name, const std::string &wName,
+                                    const TH2F &model)
+   {
+      return BookFill<TH2F, V1, V2, W>(std::make_shared<TH2F>(model), {v1Name, v2Name, wName});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a three-dimensional histogram (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the values on the y axis.
+   /// \tparam V3 The type of the branch of the values on the z axis.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the values on the y axis.
+   /// \param[in] v3Name The name of the branch of the values on the z axis.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double, typename V3 = double>
+   TActionResultProxy<TH3F> Histo3D(const std::string &v1Name, const std::string &v2Name, const std::string &v3Name,
+                                    const TH3F &model)
+   {
+      return BookFill<TH3F, V1, V2, V3>(std::make_shared<TH3F>(model), {v1Name, v2Name, v3Name});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a weighted three-dimensional histogram (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the values on the y axis.
+   /// \tparam V3 The type of the branch of the values on the z axis.
+   /// \tparam W The type of the branch of the weights.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the values on the y axis.
+   /// \param[in] v3Name The name of the branch of the values on the z axis.
+   /// \param[in] wName The name of the branch of the weights.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double, typename V3 = double, typename W = double>
+   TActionResultProxy<TH3F> Histo3D(const std::string &v1Name, const std::string &v2Name, const std::string &v3Name,
+                                    const std::string &wName, const TH3F &model)
+   {
+      return BookFill<TH3F, V1, V2, V3, W>(std::make_shared<TH3F>(model), {v1Name, v2Name, v3Name, wName});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional profile (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the profiled values.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the profiled values.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double>
+   TActionResultProxy<TProfile> Profile1D(const std::string &v1Name, const std::string &v2Name, const TProfile &model)
+   {
+      return BookFill<TProfile, V1, V2>(std::make_shared<TProfile>(model), {v1Name, v2Name});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a weighted one-dimensional profile (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the profiled values.
+   /// \tparam W The type of the branch of the weights.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the profiled values.
+   /// \param[in] wName The name of the branch of the weights.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double, typename W = double>
+   TActionResultProxy<TProfile> Profile1D(const std::string &v1Name, const std::string &v2Name,
+                                          const std::string &wName, const TProfile &model)
+   {
+      return BookFill<TProfile, V1, V2, W>(std::make_shared<TProfile>(model), {v1Name, v2Name, wName});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a two-dimensional profile (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the values on the y axis.
+   /// \tparam V3 The type of the branch of the profiled values.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the values on the y axis.
+   /// \param[in] v3Name The name of the branch of the profiled values.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double, typename V3 = double>
+   TActionResultProxy<TProfile2D> Profile2D(const std::string &v1Name, const std::string &v2Name,
+                                            const std::string &v3Name, const TProfile2D &model)
+   {
+      return BookFill<TProfile2D, V1, V2, V3>(std::make_shared<TProfile2D>(model), {v1Name, v2Name, v3Name});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a weighted two-dimensional profile (*lazy action*)
+   /// \tparam V1 The type of the branch of the values on the x axis.
+   /// \tparam V2 The type of the branch of the values on the y axis.
+   /// \tparam V3 The type of the branch of the profiled values.
+   /// \tparam W The type of the branch of the weights.
+   /// \param[in] v1Name The name of the branch of the values on the x axis.
+   /// \param[in] v2Name The name of the branch of the values on the y axis.
+   /// \param[in] v3Name The name of the branch of the profiled values.
+   /// \param[in] wName The name of the branch of the weights.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// See the weighted version of Histo for the types of the branches and for collection branches.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V1 = double, typename V2 = double, typename V3 = double, typename W = double>
+   TActionResultProxy<TProfile2D> Profile2D(const std::string &v1Name, const std::string &v2Name,
+                                            const std::string &v3Name, const std::string &wName,
+                                            const TProfile2D &model)
+   {
+      return BookFill<TProfile2D, V1, V2, V3, W>(std::make_shared<TProfile2D>(model),
+                                                 {v1Name, v2Name, v3Name, wName});
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the minimum of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> Min(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the minumum");
+      auto minV = std::make_shared<double>(std::numeric_limits<double>::max());
+      return CreateAction<T, Internal::EActionType::kMin>(theBranchName, minV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the maximum of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> Max(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the maximum");
+      auto maxV = std::make_shared<double>(std::numeric_limits<double>::lowest());
+      return CreateAction<T, Internal::EActionType::kMax>(theBranchName, maxV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the mean of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> Mean(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the mean");
+      auto meanV = std::make_shared<double>(0);
+      return CreateAction<T, Internal::EActionType::kMean>(theBranchName, meanV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return count, sum, mean, variance, minimum and maximum of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// All statistics are calculated in a single pass, without loss of precision with the number of values:
+   /// see TStatistics. The values of collections are all taken into account.
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<TStatistics> Stats(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the statistics");
+      auto statsV = std::make_shared<TStatistics>();
+      return CreateAction<T, Internal::EActionType::kStats>(theBranchName, statsV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return approximate quantiles of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   /// \param[in] quantiles The quantiles to be calculated, in [0, 1].
+   /// \param[in] accuracy The maximum error on the rank of the returned values, as a fraction of their number.
+   ///
+   /// Returns, in the order of `quantiles`, a value the rank of which is within `accuracy * N` of `q * N`
+   /// for each quantile `q`, with a probability of 99%, where N is the number of values (nan values are
+   /// ignored). Quantiles 0 and 1 give the exact minimum and maximum.
+   /// Each slot fills a sketch of the distribution of its values, of a fixed size of a few times
+   /// 2.3 / accuracy values whatever N, and the sketches are merged at the end of the event loop: see
+   /// TQuantileSketch. If all values fit in the sketch, the quantiles are exact.
+   /// The values of collections are all taken into account.
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<std::vector<double>>
+   Quantiles(const std::string &branchName, const std::vector<double> &quantiles, double accuracy = 0.01)
+   {
+      for (auto q : quantiles) {
+         if (!(q >= 0. && q <= 1.)) throw std::runtime_error("Quantiles: quantiles must be in [0, 1]");
+      }
+      if (!(accuracy > 0. && accuracy < 1.)) throw std::runtime_error("Quantiles: accuracy must be in (0, 1)");
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the quantiles");
+      auto quantilesV = std::make_shared<std::vector<double>>();
+      const auto k = Internal::Operations::TQuantileSketch::GetCapacityForAccuracy(accuracy);
+      return CreateAction<T, Internal::EActionType::kQuantiles>(theBranchName, quantilesV, quantiles, k);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Aggregate the values of a branch in an accumulator of any type (*lazy action*)
+   /// \param[in] init Callable returning the initial value of the accumulator.
+   /// \param[in] accumulate Callable adding a value of the branch to an accumulator.
+   /// \param[in] merge Callable merging the second accumulator into the first.
+   /// \param[in] branchName The name of the branch.
+   ///
+   /// `accumulate` either updates the accumulator in place, `void(Acc &, const T &)`, or
+   /// returns the updated accumulator, `Acc(const Acc &, const T &)`; the type of the
+   /// branch is the type of its second parameter. Likewise, `merge` is either
+   /// `void(Acc &, const Acc &)` or `Acc(const Acc &, const Acc &)`.
+   /// `init` is called once: each processing slot starts from a copy of its result, which
+   /// must therefore be an identity of `merge` (e.g. 0 for a sum). At the end of the event
+   /// loop the accumulators of the slots are merged pairwise, in log2(nSlots) rounds the
+   /// merges of which run in parallel: `merge` must be associative, and is called by several
+   /// threads at once on distinct accumulators.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename InitF, typename AccF, typename MergeF>
+   TActionResultProxy<typename std::decay<typename Internal::TDFTraitsUtils::TFunctionTraits<InitF>::RetType_t>::type>
+   Aggregate(InitF init, AccF accumulate, MergeF merge, const std::string &branchName = "")
+   {
+      namespace IU = Internal::TDFTraitsUtils;
+      using Acc_t = typename std::decay<typename IU::TFunctionTraits<InitF>::RetType_t>::type;
+      using AccArgs_t = typename IU::TFunctionTraits<AccF>::ArgTypes_t;
+      using T = typename IU::TTakeFirst<typename IU::TRemoveFirst<AccArgs_t>::Types_t>::Type_t;
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "aggregate");
+      auto df = GetDataFrameChecked();
+      auto accPtr = std::make_shared<Acc_t>(init());
+      using Op_t = Internal::Operations::AggregateOperation<Acc_t, AccF, MergeF>;
+      // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+      auto aggregateOp = std::make_shared<Op_t>(accumulate, merge, accPtr, df->GetNSlots());
+      Internal::Operations::TOperationCaller<Op_t, T> aggregateAction(aggregateOp);
+      BranchNames bl = {theBranchName};
+      using DFA_t = Internal::TDataFrameAction<decltype(aggregateAction), Proxied>;
+      df->Book(std::make_shared<DFA_t>(aggregateAction, bl, fProxiedPtr));
+      df->SetPartialMerger(accPtr.get(), aggregateOp);
+      return df->MakeActionResultPtr(accPtr);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Reduce the values of a branch with a binary operation (*lazy action*)
+   /// \tparam T The type of the branch, and of the result.
+   /// \param[in] op Callable combining two values, `T(const T &, const T &)`.
+   /// \param[in] branchName The name of the branch.
+   /// \param[in] init The identity of `op`, e.g. 0 for a sum or 1 for a product.
+   ///
+   /// The values processed by each slot are reduced with `op`, starting from `init`, and the
+   /// results of the slots are then reduced the same way: `op` must be associative.
+   /// See Aggregate.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename F,
+             typename T = typename std::decay<typename Internal::TDFTraitsUtils::TFunctionTraits<F>::RetType_t>::type>
+   TActionResultProxy<T> Reduce(F op, const std::string &branchName = "", const T &init = T())
+   {
+      return Aggregate([init]() { return init; }, op, op, branchName);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Evaluate chains of filters in the order measured to be the fastest
+   /// \param[in] reorder Whether consecutive filters should be reordered.
+   ///
+   /// Filters declared one after the other, with no temporary branch or range
+   /// in between, are considered commutative: the user guarantees that each
+   /// of them can be evaluated on any entry, whatever the others return. For
+   /// the first entries it processes, each slot evaluates all the filters of
+   /// such a chain and measures their pass rate and evaluation time, then it
+   /// evaluates them by increasing cost per rejected entry, so that cheap and
+   /// selective cuts run first. Each filter is evaluated at most once per
+   /// entry, and results are the same as with in-order evaluation. Kernel
+   /// mode always evaluates filters in the order they were declared.
+   void SetFilterReordering(bool reorder = true)
+   {
+      GetDataFrameChecked()->SetFilterReordering(reorder);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Measure where the time of the event loop goes
+   /// \param[in] profile Whether the next event loops should be profiled.
+   ///
+   /// In profiling mode, every filter, temporary branch and action accumulates
+   /// the wall time it takes and the number of times it is called, in
+   /// counters local to each slot; so do the calls to TTreeReader::Next and
+   /// the loads of the values of real branches. The counters are summed at the
+   /// end of the event loop, see GetProfile. When profiling is disabled, no
+   /// clock is read and no counter is allocated.
+   void SetProfiling(bool profile = true)
+   {
+      GetDataFrameChecked()->SetProfiling(profile);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the profile of the last profiled event loop
+   ///
+   /// The profile lists the nodes booked on the data frame, and can be
+   /// exported with TDataFrameProfile::ToJSON. It is empty if no event loop
+   /// ran with profiling enabled.
+   const TDataFrameProfile &GetProfile()
+   {
+      return GetDataFrameChecked()->GetProfile();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Set the granularity of the tasks of parallel event loops
+   /// \param[in] taskSize The number of entries per task. 0 lets TDataFrame choose.
    ///
-   /// Append a filter node at the point of the call graph corresponding to the
-   /// object this method is called on.
-   /// The callable `f` should not have side-effects (e.g. modification of an
-   /// external or static variable) to ensure correct results when implicit
-   /// multi-threading is active.
+   /// In parallel runs the entries of all input files are split in ranges of
+   /// about `taskSize` entries. Clusters smaller than a task are never split,
+   /// larger clusters are split in several tasks. Each slot works through its
+   /// own share of the tasks and, when done, steals tasks from the other slots.
+   void SetTaskSize(Long64_t taskSize)
+   {
+      GetDataFrameChecked()->SetTaskSize(taskSize);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Process the entries of the next event loops in blocks
+   /// \param[in] batchSize The number of entries per block. 0, the default, processes entries one by one.
    ///
-   /// TDataFrame only evaluates filters when necessary: if multiple filters
-   /// are chained one after another, they are executed in order and the first
-   /// one returning false causes the event to be discarded.
-   /// Even if multiple actions or transformations depend on the same filter,
-   /// it is executed once per entry. If its result is requested more than
-   /// once, the cached result is served.
-   template <typename F>
-   TDataFrameInterface<Details::TDataFrameFilter<F, Proxied>> Filter(F f, const BranchNames &bl = {})
+   /// In batched mode each slot copies the values of the real branches read by
+   /// the graph, entry by entry, in one array per branch and block. Each filter
+   /// then runs once over the entries of the block that passed the filters
+   /// upstream and produces the list of those it accepts, each temporary branch
+   /// fills one array with its values at the entries that need them, and each
+   /// action receives the values of the selected entries in one call: Count,
+   /// Min, Max, Mean and Histo accumulate them in a single pass. Event loops
+   /// whose graph reads an array branch process entries one by one.
+   void SetBatchSize(unsigned int batchSize)
+   {
+      GetDataFrameChecked()->SetBatchSize(batchSize);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Compile the functional graph in a kernel evaluated top-down
+   /// \param[in] useKernel Whether the next event loops should run the kernel.
+   ///
+   /// By default each action checks the chain of filters upstream of it, and
+   /// filters shared by several actions cache their result for the current
+   /// entry. In kernel mode, before the event loop starts, the graph reachable
+   /// from the booked actions is compiled into a tree of filters that every
+   /// slot runs over blocks of entries: each filter is evaluated exactly once
+   /// on the entries of the block its parent selected, and the actions
+   /// depending on it are executed right after on the entries it selected.
+   /// Each node is reached through one virtual call per block, and the loops
+   /// over the entries run in its typed code. Blocks are as large as set by
+   /// SetBatchSize, or 1024 entries. Filters are evaluated in the order they
+   /// were declared, even if filter reordering is enabled; event loops whose
+   /// graph reads an array branch do not run the kernel. Results are the same
+   /// as with the default dispatch.
+   void SetKernelMode(bool useKernel = true)
+   {
+      GetDataFrameChecked()->SetKernelMode(useKernel);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Get the number of entries processed by each slot in the last event loop
+   std::vector<ULong64_t> GetEntriesPerSlot()
+   {
+      return GetDataFrameChecked()->GetEntriesPerSlot();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Get the names of the branches the next event loop will read
+   ///
+   /// These are the real branches used by the booked actions and by the filters
+   /// and temporary branches upstream of them. Only these branches are enabled
+   /// in the input tree and prefetched by its cache during the event loop.
+   BranchNames GetReadSet()
+   {
+      return GetDataFrameChecked()->GetReadSet();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Run the event loops of this data frame and of another one together
+   /// \param[in] other A data frame, or a node of a data frame, reading the same tree from the same files.
+   ///
+   /// From now on, the event loop triggered by either data frame also executes
+   /// the pending lazy actions of the other, and marks their results as ready:
+   /// the data is read once for both. Data frames sharing their event loop with
+   /// either one are included, so that several studies on the same data-set can
+   /// be grouped by chaining calls. The settings of the data frame triggering the
+   /// event loop, e.g. the task size, are used.
+   template <typename T>
+   void ShareEventLoop(TDataFrameInterface<T> &other);
+
+private:
+   TDataFrameInterface(std::shared_ptr<Proxied> proxied) : fProxiedPtr(proxied) {}
+
+   /// Get the TDataFrameImpl if reachable. If not, throw.
+   std::shared_ptr<Details::TDataFrameImpl> GetDataFrameChecked()
+   {
+      auto df = fProxiedPtr->GetDataFrame().lock();
+      if (!df) {
+         throw std::runtime_error("The main TDataFrame is not reachable: did it go out of scope?");
+      }
+      return df;
+   }
+
+   void GetDefaultBranchName(std::string &theBranchName, const std::string &actionNameForErr)
+   {
+      if (theBranchName.empty()) {
+         // Try the default branch if possible
+         auto df = GetDataFrameChecked();
+         const BranchNames &defBl = df->GetDefaultBranches();
+         if (defBl.size() == 1) {
+            theBranchName = defBl[0];
+         } else {
+            std::string msg("No branch in input to ");
+            msg += actionNameForErr;
+            msg += " and default branch list has size ";
+            msg += std::to_string(defBl.size());
+            msg += ", need 1";
+            throw std::runtime_error(msg);
+         }
+      }
+   }
+
+   template <typename BranchType, typename ActionResultType, enum Internal::EActionType, typename ThisType>
+   struct SimpleAction {};
+
+   template <typename BranchType, typename ThisType>
+   struct SimpleAction<BranchType, TH1F, Internal::EActionType::kHisto1D, ThisType> {
+      static TActionResultProxy<TH1F> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                 std::shared_ptr<TH1F> h, unsigned int nSlots)
+      {
+         // we use a shared_ptr so that the operation has the same scope of the lambda
+         // and therefore of the TDataFrameAction that contains it: merging of results
+         // from different threads is performed in the operation's destructor, at the
+         // moment when the TDataFrameAction is deleted by TDataFrameImpl
+         BranchNames bl = {theBranchName};
+         auto df = thisFrame->GetDataFrameChecked();
+         auto xaxis = h->GetXaxis();
+         auto hasAxisLimits = !(xaxis->GetXmin() == 0. && xaxis->GetXmax() == 0.);
+
+         if (hasAxisLimits) {
+            auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation<TH1F>>(h, nSlots);
+            Internal::Operations::TOperationCaller<Internal::Operations::FillTOOperation<TH1F>, BranchType> fillAction(
+               fillTOOp);
+            using DFA_t = Internal::TDataFrameAction<decltype(fillAction), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillAction, bl, thisFrame->fProxiedPtr));
+            df->SetPartialMerger(h.get(), fillTOOp);
+         } else {
+            auto fillOp = std::make_shared<Internal::Operations::FillOperation>(h, nSlots);
+            Internal::Operations::TOperationCaller<Internal::Operations::FillOperation, BranchType> fillAction(fillOp);
+            using DFA_t = Internal::TDataFrameAction<decltype(fillAction), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillAction, bl, thisFrame->fProxiedPtr));
+            df->SetPartialMerger(h.get(), fillOp);
+         }
+         return df->MakeActionResultPtr(h);
+      }
+   };
+
+   template <typename BranchType, typename ThisType, typename ActionResultType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kMin, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> minV, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         auto minOp = std::make_shared<Internal::Operations::MinOperation>(minV.get(), nSlots);
+         Internal::Operations::TOperationCaller<Internal::Operations::MinOperation, BranchType> minAction(minOp);
+         BranchNames bl = {theBranchName};
+         using DFA_t = Internal::TDataFrameAction<decltype(minAction), Proxied>;
+         df->Book(std::make_shared<DFA_t>(minAction, bl, thisFrame->fProxiedPtr));
+         df->SetPartialMerger(minV.get(), minOp);
+         return df->MakeActionResultPtr(minV);
+      }
+   };
+
+   template <typename BranchType, typename ThisType, typename ActionResultType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kMax, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> maxV, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         auto maxOp = std::make_shared<Internal::Operations::MaxOperation>(maxV.get(), nSlots);
+         Internal::Operations::TOperationCaller<Internal::Operations::MaxOperation, BranchType> maxAction(maxOp);
+         BranchNames bl = {theBranchName};
+         using DFA_t = Internal::TDataFrameAction<decltype(maxAction), Proxied>;
+         df->Book(std::make_shared<DFA_t>(maxAction, bl, thisFrame->fProxiedPtr));
+         df->SetPartialMerger(maxV.get(), maxOp);
+         return df->MakeActionResultPtr(maxV);
+      }
+   };
+
+   template <typename BranchType, typename ThisType, typename ActionResultType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kMean, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> meanV, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         auto meanOp = std::make_shared<Internal::Operations::MeanOperation>(meanV.get(), nSlots);
+         Internal::Operations::TOperationCaller<Internal::Operations::MeanOperation, BranchType> meanAction(meanOp);
+         BranchNames bl = {theBranchName};
+         using DFA_t = Internal::TDataFrameAction<decltype(meanAction), Proxied>;
+         df->Book(std::make_shared<DFA_t>(meanAction, bl, thisFrame->fProxiedPtr));
+         df->SetPartialMerger(meanV.get(), meanOp);
+         return df->MakeActionResultPtr(meanV);
+      }
+   };
+
+   template <typename BranchType, typename ThisType, typename ActionResultType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kStats, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> statsV, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         auto statsOp = std::make_shared<Internal::Operations::StatsOperation>(statsV.get(), nSlots);
+         Internal::Operations::TOperationCaller<Internal::Operations::StatsOperation, BranchType> statsAction(statsOp);
+         BranchNames bl = {theBranchName};
+         using DFA_t = Internal::TDataFrameAction<decltype(statsAction), Proxied>;
+         df->Book(std::make_shared<DFA_t>(statsAction, bl, thisFrame->fProxiedPtr));
+         df->SetPartialMerger(statsV.get(), statsOp);
+         return df->MakeActionResultPtr(statsV);
+      }
+   };
+
+   template <typename BranchType, typename ThisType, typename ActionResultType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kQuantiles, ThisType> {
+      static TActionResultProxy<ActionResultType>
+      BuildAndBook(ThisType thisFrame, const std::string &theBranchName, std::shared_ptr<ActionResultType> quantilesV,
+                   unsigned int nSlots, const std::vector<double> &quantiles, std::size_t k)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         auto quantilesOp =
+            std::make_shared<Internal::Operations::QuantilesOperation>(quantilesV, quantiles, k, nSlots);
+         Internal::Operations::TOperationCaller<Internal::Operations::QuantilesOperation, BranchType> quantilesAction(
+            quantilesOp);
+         BranchNames bl = {theBranchName};
+         using DFA_t = Internal::TDataFrameAction<decltype(quantilesAction), Proxied>;
+         df->Book(std::make_shared<DFA_t>(quantilesAction, bl, thisFrame->fProxiedPtr));
+         df->SetPartialMerger(quantilesV.get(), quantilesOp);
+         return df->MakeActionResultPtr(quantilesV);
+      }
+   };
+
+   /// The arguments following the result are forwarded to the BuildAndBook of the action
+   template <typename BranchType, Internal::EActionType ActionType, typename ActionResultType, typename... Args>
+   TActionResultProxy<ActionResultType> CreateAction(const std::string & theBranchName,
+                                                   std::shared_ptr<ActionResultType> r, const Args &... args)
+   {
+      // More types can be added at will at the cost of some compilation time and size of binaries.
+      using ART_t = ActionResultType;
+      using TT_t = decltype(this);
+      const auto at = ActionType;
+      auto df = GetDataFrameChecked();
+      auto tree = df->GetTree();
+      auto branch = tree ? tree->GetBranch(theBranchName.c_str()) : nullptr;
+      unsigned int nSlots = df->GetNSlots();
+      if (!branch) {
+         // temporary branch
+         const auto &type_id = df->GetBookedBranch(theBranchName).GetTypeId();
+         if (type_id == typeid(char)) {
+            return SimpleAction<char, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         } else if (type_id == typeid(int)) {
+            return SimpleAction<int, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         } else if (type_id == typeid(double)) {
+            return SimpleAction<double, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         } else if (type_id == typeid(double)) {
+            return SimpleAction<double, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         } else if (type_id == typeid(std::vector<double>)) {
+            return SimpleAction<std::vector<double>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         } else if (type_id == typeid(std::vector<float>)) {
+            return SimpleAction<std::vector<float>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         }
+         return SimpleAction<BranchType, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+      }
+      // real branch
+      auto branchEl = dynamic_cast<TBranchElement *>(branch);
+      if (!branchEl) { // This is a fundamental type
+         auto title    = branch->GetTitle();
+         auto typeCode = title[strlen(title) - 1];
+         if (strchr(title, '[')) { // This is an array of a fundamental type, e.g. "x[n]/F"
+            if (typeCode == 'I') {
+               return SimpleAction<TArrayBranch<int>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+            } else if (typeCode == 'F') {
+               return SimpleAction<TArrayBranch<float>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+            } else if (typeCode == 'D') {
+               return SimpleAction<TArrayBranch<double>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+            }
+         } else if (typeCode == 'B') {
+            return SimpleAction<char, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         }
+         // else if (typeCode == 'b') { return SimpleAction<Uchar, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         // else if (typeCode == 'S') { return SimpleAction<Short_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         // else if (typeCode == 's') { return SimpleAction<UShort_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         else if (typeCode == 'I') {
+            return SimpleAction<int, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         }
+         // else if (typeCode == 'i') { return SimpleAction<unsigned int , ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         // else if (typeCode == 'F') { return SimpleAction<float, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         else if (typeCode == 'D') {
+            return SimpleAction<double, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         }
+         // else if (typeCode == 'L') { return SimpleAction<Long64_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         // else if (typeCode == 'l') { return SimpleAction<ULong64_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...); }
+         else if (typeCode == 'O') {
+            return SimpleAction<bool, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         }
+      } else {
+         std::string typeName = branchEl->GetTypeName();
+         if (typeName == "vector<double>") {
+            return SimpleAction<std::vector<double>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         } else if (typeName == "vector<float>") {
+            return SimpleAction<std::vector<float>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+         }
+      }
+      return SimpleAction<BranchType, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots, args...);
+   }
+
+   /// Book the filling of a histogram or profile with the values of several branches, one per argument of Fill
+   template <typename HIST, typename... BranchTypes>
+   TActionResultProxy<HIST> BookFill(std::shared_ptr<HIST> h, const BranchNames &bl)
+   {
+      // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+      auto df = GetDataFrameChecked();
+      auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation<HIST>>(h, df->GetNSlots());
+      auto fillLambda = [fillTOOp](unsigned int slot, const BranchTypes &... vs) mutable { fillTOOp->Exec(slot, vs...); };
+      using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+      df->Book(std::make_shared<DFA_t>(fillLambda, bl, fProxiedPtr));
+      df->SetPartialMerger(h.get(), fillTOOp);
+      return df->MakeActionResultPtr(h);
+   }
+
+   std::shared_ptr<Proxied> fProxiedPtr;
+};
+
+using TDataFrame = TDataFrameInterface<ROOT::Details::TDataFrameImpl>;
+
+namespace Details {
+
+class TDataFrameBranchBase {
+public:
+   virtual ~TDataFrameBranchBase() {}
+   virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
+   virtual void CreateSlots(unsigned int nSlots) = 0;
+   virtual std::string GetName() const       = 0;
+   virtual void *GetValue(unsigned int slot, int entry) = 0;
+   /// The values of this branch in a block, valid at least at the selected positions
+   virtual void *GetBlockValues(unsigned int slot, const Internal::TEntryBlock &block,
+                                const Internal::TBlockSelection_t &sel) = 0;
+   virtual const std::type_info &GetTypeId() const = 0;
+   /// Add the time spent evaluating this branch during the last event loop, if profiled, to the profile
+   virtual void AddProfile(TDataFrameProfile &profile) const = 0;
+};
+using TmpBranchBasePtr_t = std::shared_ptr<TDataFrameBranchBase>;
+
+/// A branch whose values are read from an array in memory, filled by a Cache transformation.
+/// The array is allocated uninitialised: values are move-constructed in it, so T does not need
+/// to be default-constructible and the pages of the array are only touched as values arrive.
+template <typename T>
+class TDataFrameCachedColumn final : public TDataFrameBranchBase {
+   const std::string fName;
+   T *fValues = nullptr;
+   ULong64_t fNValues = 0;
+
+public:
+   TDataFrameCachedColumn(const std::string &name) : fName(name) {}
+   TDataFrameCachedColumn(const TDataFrameCachedColumn &) = delete;
+   ~TDataFrameCachedColumn()
+   {
+      for (ULong64_t i = 0; i < fNValues; ++i) fValues[i].~T();
+      ::operator delete(fValues);
+   }
+
+   /// Allocate the storage for n values. Must be called once, before Append.
+   void Reserve(ULong64_t n) { fValues = static_cast<T *>(::operator new(n * sizeof(T))); }
+
+   /// Move a value at the end of the array. At most n values, as passed to Reserve, can be appended.
+   void Append(T &&value)
+   {
+      new (fValues + fNValues) T(std::move(value));
+      ++fNValues;
+   }
+
+   void BuildReaderValues(TTreeReader &, unsigned int) {}
+   void CreateSlots(unsigned int) {}
+   std::string GetName() const { return fName; }
+   void *GetValue(unsigned int, int entry) { return static_cast<void *>(&fValues[entry]); }
+   // blocks span consecutive entries: their values are already in an array
+   void *GetBlockValues(unsigned int, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &)
+   {
+      return static_cast<void *>(fValues + block.fFirst);
+   }
+   const std::type_info &GetTypeId() const { return typeid(T); }
+   // reading a value from memory is not worth profiling
+   void AddProfile(TDataFrameProfile &) const {}
+};
+
+template <typename F, typename PrevData>
+class TDataFrameBranch final : public TDataFrameBranchBase {
+   using BranchTypes_t = typename Internal
+   ::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t;
+   using TypeInd_t = typename Internal::TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
+   using RetType_t = typename Internal::TDFTraitsUtils::TFunctionTraits<F>::RetType_t;
+
+   /// The state of a slot: the last entry the expression was evaluated for, and its value.
+   /// The value is constructed in place the first time the slot evaluates the expression.
+   /// In batched mode, the values of the current block and the positions they were evaluated at.
+   struct TSlotState {
+      int fLastCheckedEntry = -1;
+      bool fHasValue = false;
+      typename std::aligned_storage<sizeof(RetType_t), alignof(RetType_t)>::type fValue;
+      ULong64_t fBlockId = 0;
+      Internal::TBlockValues<RetType_t> fBlockValues;
+      std::vector<bool> fIsEvaluated;       ///< Whether the value at each position of the block was evaluated
+      Internal::TBlockSelection_t fMissing; ///< The requested positions that were not evaluated yet
+
+      TSlotState() = default;
+      TSlotState(const TSlotState &) = delete;
+      ~TSlotState()
+      {
+         if (fHasValue) GetValuePtr()->~RetType_t();
+      }
+      RetType_t *GetValuePtr() { return reinterpret_cast<RetType_t *>(&fValue); }
+   };
+
+   const std::string fName;
+   F fExpression;
+   const BranchNames fBranches;
+   BranchNames fTmpBranches;
+   std::vector<ROOT::Internal::TVBVec_t> fReaderValues;
+   std::vector<std::vector<void *>> fBlockColumns; ///< The arrays of the real branches, in batched mode
+   std::vector<ROOT::Internal::TmpBranchPtrVec_t> fTmpBranchPtrs;
+   Internal::TSlotStorage<TSlotState> fSlotStates;
+   std::weak_ptr<TDataFrameImpl> fFirstData;
+   PrevData *fPrevData;
+   Internal::ProfileStorage_t fProfileCounters;          ///< Empty unless the event loop is profiled
+   Internal::ProfileStorage_t *fLoadCounters = nullptr; ///< The reader loads of the data frame, if profiled
+   unsigned int fNChildren = 0;                  ///< Number of nodes downstream that lead to booked actions
+   std::atomic<unsigned int> fNStopsReceived{0}; ///< Number of nodes downstream that stopped processing entries
+
+public:
+   TDataFrameBranch(const std::string &name, F expression, const BranchNames &bl, std::shared_ptr<PrevData> pd)
+      : fName(name), fExpression(expression), fBranches(bl), fTmpBranches(pd->GetTmpBranches()),
+        fFirstData(pd->GetDataFrame()), fPrevData(pd.get())
+   {
+      fTmpBranches.emplace_back(name);
+   }
+
+   TDataFrameBranch(const TDataFrameBranch &) = delete;
+
+   std::weak_ptr<TDataFrameImpl> GetDataFrame() const { return fFirstData; }
+
+   BranchNames GetTmpBranches() const { return fTmpBranches; }
+
+   void BuildReaderValues(TTreeReader &r, unsigned int slot)
    {
-      ROOT::Internal::CheckFilter(f);
-      auto df = GetDataFrameChecked();
-      const BranchNames &defBl = df->GetDefaultBranches();
-      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
-      const BranchNames &actualBl = Internal::PickBranchNames(nArgs, bl, defBl);
-      using DFF_t = Details::TDataFrameFilter<F, Proxied>;
-      auto FilterPtr = std::make_shared<DFF_t> (f, actualBl, fProxiedPtr);
-      TDataFrameInterface<DFF_t> tdf_f(FilterPtr);
-      df->Book(FilterPtr);
-      return tdf_f;
+      auto df = fFirstData.lock();
+      auto &state = fSlotStates[slot];
+      const auto batchSize = Internal::GetLoopBatchSize(*df);
+      if (batchSize > 0) {
+         // the values of the branches read in batched mode are copied at every entry: a node that leads to no
+         // booked action reads none
+         if (fNChildren > 0)
+            fBlockColumns[slot] =
+               Internal::BuildBlockColumns(*df, r, slot, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+         state.fBlockValues.Allocate(batchSize);
+         state.fIsEvaluated.assign(batchSize, false);
+      } else {
+         fReaderValues[slot] = Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      }
+      fTmpBranchPtrs[slot] = Internal::BuildTmpBranchPtrs(*df, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      // entry numbers start over in every file: forget the entry checked by the previous reader of this slot
+      state.fLastCheckedEntry = -1;
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Creates a temporary branch
-   /// \param[in] name The name of the temporary branch.
-   /// \param[in] expression Function, lambda expression, functor class or any other callable object producing the temporary value. Returns the value that will be assigned to the temporary branch.
-   /// \param[in] bl Names of the branches in input to the producer function.
-   ///
-   /// Create a temporary branch that will be visible from all subsequent nodes
-   /// of the functional chain. The `expression` is only evaluated for entries that pass
-   /// all the preceding filters.
-   /// A new variable is created called `name`, accessible as if it was contained
-   /// in the dataset from subsequent transformations/actions.
-   ///
-   /// Use cases include:
-   ///
-   /// * caching the results of complex calculations for easy and efficient multiple access
-   /// * extraction of quantities of interest from complex objects
-   /// * branch aliasing, i.e. changing the name of a branch
-   ///
-   /// An exception is thrown if the name of the new branch is already in use
-   /// for another branch in the TTree.
-   template <typename F>
-   TDataFrameInterface<Details::TDataFrameBranch<F, Proxied>>
-   AddBranch(const std::string &name, F expression, const BranchNames &bl = {})
+   void *GetValue(unsigned int slot, int entry)
    {
-      auto df = GetDataFrameChecked();
-      ROOT::Internal::CheckTmpBranch(name, df->GetTree());
-      const BranchNames &defBl = df->GetDefaultBranches();
-      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
-      const BranchNames &actualBl = Internal::PickBranchNames(nArgs, bl, defBl);
-      using DFB_t = Details::TDataFrameBranch<F, Proxied>;
-      auto BranchPtr = std::make_shared<DFB_t>(name, expression, actualBl, fProxiedPtr);
-      TDataFrameInterface<DFB_t> tdf_b(BranchPtr);
-      df->Book(BranchPtr);
-      return tdf_b;
+      auto &state = fSlotStates[slot];
+      if (entry != state.fLastCheckedEntry) {
+         // evaluate this branch, cache the result in the storage of this slot
+         Internal::TProfileTimer timer(Internal::GetSlotCounters(fProfileCounters, slot));
+         UpdateValueHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
+         state.fLastCheckedEntry = entry;
+      }
+      return static_cast<void *>(state.GetValuePtr());
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Execute a user-defined function on each entry (*instant action*)
-   /// \param[in] f Function, lambda expression, functor class or any other callable object performing user defined calculations.
-   /// \param[in] bl Names of the branches in input to the user function.
-   ///
-   /// The callable `f` is invoked once per entry. This is an *instant action*:
-   /// upon invocation, an event loop as well as execution of all scheduled actions
-   /// is triggered.
-   /// Users are responsible for the thread-safety of this callable when executing
-   /// with implicit multi-threading enabled (i.e. ROOT::EnableImplicitMT).
-   template <typename F>
-   void Foreach(F f, const BranchNames &bl = {})
+   void *GetBlockValues(unsigned int slot, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel)
    {
-      namespace IU = Internal::TDFTraitsUtils;
-      using ArgTypes_t = typename IU::TFunctionTraits<decltype(f)>::ArgTypesNoDecay_t;
-      using RetType_t = typename IU::TFunctionTraits<decltype(f)>::RetType_t;
-      auto fWithSlot = IU::AddSlotParameter<RetType_t>(f, ArgTypes_t());
-      ForeachSlot(fWithSlot, bl);
+      auto &state = fSlotStates[slot];
+      if (block.fId != state.fBlockId) {
+         std::fill(state.fIsEvaluated.begin(), state.fIsEvaluated.end(), false);
+         state.fBlockId = block.fId;
+      }
+      // nodes downstream may select different entries: the expression is evaluated for those it was not yet
+      auto &missing = state.fMissing;
+      missing.clear();
+      for (auto pos : sel)
+         if (!state.fIsEvaluated[pos]) missing.emplace_back(pos);
+      if (!missing.empty()) {
+         Internal::TProfileTimer timer(Internal::GetSlotCounters(fProfileCounters, slot), missing.size());
+         UpdateBlockHelper(BranchTypes_t(), TypeInd_t(), slot, block, missing);
+         for (auto pos : missing) state.fIsEvaluated[pos] = true;
+      }
+      return static_cast<void *>(state.fBlockValues.GetValues());
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Execute a user-defined function requiring a processing slot index on each entry (*instant action*)
-   /// \param[in] f Function, lambda expression, functor class or any other callable object performing user defined calculations.
-   /// \param[in] bl Names of the branches in input to the user function.
-   ///
-   /// Same as `Foreach`, but the user-defined function takes an extra
-   /// `unsigned int` as its first parameter, the *processing slot index*.
-   /// This *slot index* will be assigned a different value, `0` to `poolSize - 1`,
-   /// for each thread of execution.
-   /// This is meant as a helper in writing thread-safe `Foreach`
-   /// actions when using `TDataFrame` after `ROOT::EnableImplicitMT()`.
-   /// The user-defined processing callable is able to follow different
-   /// *streams of processing* indexed by the first parameter.
-   /// `ForeachSlot` works just as well with single-thread execution: in that
-   /// case `slot` will always be `0`.
-   template<typename F>
-   void ForeachSlot(F f, const BranchNames &bl = {}) {
-      auto df = GetDataFrameChecked();
-      const BranchNames &defBl= df->GetDefaultBranches();
-      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
-      const BranchNames &actualBl = Internal::PickBranchNames(nArgs-1, bl, defBl);
-      using DFA_t  = Internal::TDataFrameAction<decltype(f), Proxied>;
-      df->Book(std::make_shared<DFA_t>(f, actualBl, fProxiedPtr));
-      df->Run();
+   const std::type_info &GetTypeId() const { return typeid(RetType_t); }
+
+   void CreateSlots(unsigned int nSlots)
+   {
+      fReaderValues.resize(nSlots);
+      fBlockColumns.resize(nSlots);
+      fTmpBranchPtrs.resize(nSlots);
+      fSlotStates.Reset(nSlots);
+      Internal::SetUpProfiling(*fFirstData.lock(), nSlots, fProfileCounters, fLoadCounters);
+      fNChildren = 0;
+      fNStopsReceived = 0;
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return the number of entries processed (*lazy action*)
-   ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   TActionResultProxy<unsigned int> Count()
+   void AddProfile(TDataFrameProfile &profile) const
    {
-      auto df = GetDataFrameChecked();
-      unsigned int nSlots = df->GetNSlots();
-      auto cShared = std::make_shared<unsigned int>(0);
-      auto c = df->MakeActionResultPtr(cShared);
-      auto cPtr = cShared.get();
-      auto cOp = std::make_shared<Internal::Operations::CountOperation>(cPtr, nSlots);
-      auto countAction = [cOp](unsigned int slot) mutable { cOp->Exec(slot); };
-      BranchNames bl = {};
-      using DFA_t = Internal::TDataFrameAction<decltype(countAction), Proxied>;
-      df->Book(std::shared_ptr<DFA_t>(new DFA_t(countAction, bl, fProxiedPtr)));
-      return c;
+      if (fProfileCounters.size() == 0) return;
+      const auto sum = Internal::SumCounters(fProfileCounters);
+      profile.AddNode("branch", fName, sum.fNCalls, sum.fTime);
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return a collection of values of a branch (*lazy action*)
-   /// \tparam T The type of the branch.
-   /// \tparam COLL The type of collection used to store the values.
-   /// \param[in] branchName The name of the branch of which the values are to be collected
-   ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T, typename COLL = std::vector<T>>
-   TActionResultProxy<COLL> Take(const std::string &branchName = "")
+   bool CheckFilters(unsigned int slot, int entry)
    {
-      auto df = GetDataFrameChecked();
-      unsigned int nSlots = df->GetNSlots();
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "get the values of the branch");
-      auto valuesPtr = std::make_shared<COLL>();
-      auto values = df->MakeActionResultPtr(valuesPtr);
-      auto getOp = std::make_shared<Internal::Operations::TakeOperation<T,COLL>>(valuesPtr, nSlots);
-      auto getAction = [getOp] (unsigned int slot , const T &v) mutable { getOp->Exec(v, slot); };
-      BranchNames bl = {theBranchName};
-      using DFA_t = Internal::TDataFrameAction<decltype(getAction), Proxied>;
-      df->Book(std::shared_ptr<DFA_t>(new DFA_t(getAction, bl, fProxiedPtr)));
-      return values;
+      // dummy call: it just forwards to the previous object in the chain
+      return fPrevData->CheckFilters(slot, entry);
    }
 
+   const Internal::TBlockSelection_t &CheckBlock(unsigned int slot, const Internal::TEntryBlock &block)
+   {
+      return fPrevData->CheckBlock(slot, block);
+   }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Fill and return a one-dimensional histogram with the values of a branch (*lazy action*)
-   /// \tparam T The type of the branch the values of which are used to fill the histogram.
-   /// \param[in] branchName The name of the branch of which the values are to be collected.
-   /// \param[in] model The model to be copied to build the new return value.
-   ///
-   /// If no branch type is specified, the implementation will try to guess one.
-   /// The returned histogram is independent of the input one.
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T = double>
-   TActionResultProxy<TH1F> Histo(const std::string &branchName, const TH1F &model)
+   bool CanProcessBlocks() const
    {
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "fill the histogram");
-      auto h = std::make_shared<TH1F>(model);
-      return CreateAction<T, Internal::EActionType::kHisto1D>(theBranchName, h);
+      return Internal::CanReadBlocks(BranchTypes_t()) && fPrevData->CanProcessBlocks();
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Fill and return a one-dimensional histogram with the values of a branch (*lazy action*)
-   /// \tparam T The type of the branch the values of which are used to fill the histogram.
-   /// \param[in] branchName The name of the branch of which the values are to be collected.
-   /// \param[in] nbins The number of bins.
-   /// \param[in] minVal The lower value of the xaxis.
-   /// \param[in] maxVal The upper value of the xaxis.
-   ///
-   /// If no branch type is specified, the implementation will try to guess one.
-   ///
-   /// If no axes boundaries are specified, all entries are buffered: at the end of
-   /// the loop on the entries, the histogram is filled. If the axis boundaries are
-   /// specified, the histogram (or histograms in the parallel case) are filled. This
-   /// latter mode may result in a reduced memory footprint.
-   ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T = double>
-   TActionResultProxy<TH1F> Histo(const std::string &branchName = "", int nBins = 128, double minVal = 0.,
-                                double maxVal = 0.)
+   void AddReadBranches(BranchNames &readSet) const
    {
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "fill the histogram");
-      auto h = std::make_shared<TH1F>("", "", nBins, minVal, maxVal);
-      if (minVal == maxVal) {
-         h->SetCanExtend(TH1::kAllAxes);
+      Internal::AddRealBranches(fBranches, fTmpBranches, readSet);
+      fPrevData->AddReadBranches(readSet);
+   }
+
+   void IncrChildrenCount()
+   {
+      // the first child leading to actions makes this node relevant for the previous one
+      if (++fNChildren == 1) fPrevData->IncrChildrenCount();
+   }
+
+   void StopProcessing()
+   {
+      // no entry will reach the nodes downstream anymore: neither will it reach this one
+      if (++fNStopsReceived == fNChildren) fPrevData->StopProcessing();
+   }
+
+   // temporary branches do not filter: nodes downstream depend on the first filter upstream
+   TDataFrameFilterBase *GetFilterAncestor() { return fPrevData->GetFilterAncestor(); }
+
+   // filters downstream may read this branch: they do not commute with the filters upstream
+   TDataFrameFilterBase *GetChainedFilter() { return nullptr; }
+
+   std::string GetName() const { return fName; }
+
+   /// Evaluate the expression and store its value in the storage of this slot.
+   /// The value is constructed the first time a slot computes it and
+   /// assigned to for all subsequent entries: no allocation happens per entry.
+   template <int... S, typename... BranchTypes>
+   void UpdateValueHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
+                          Internal::TDFTraitsUtils::TStaticSeq<S...>,
+                          unsigned int slot, int entry)
+   {
+      auto &state = fSlotStates[slot];
+      if (state.fHasValue) {
+         *state.GetValuePtr() = fExpression(Internal::GetBranchValue<S, BranchTypes>(
+            fReaderValues[slot][S], fTmpBranchPtrs[slot][S], slot, entry,
+            Internal::GetSlotCounters(fLoadCounters, slot))...);
+      } else {
+         new (state.GetValuePtr()) RetType_t(fExpression(Internal::GetBranchValue<S, BranchTypes>(
+            fReaderValues[slot][S], fTmpBranchPtrs[slot][S], slot, entry,
+            Internal::GetSlotCounters(fLoadCounters, slot))...));
+         state.fHasValue = true;
       }
-      return CreateAction<T, Internal::EActionType::kHisto1D>(theBranchName, h);
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return the minimum of processed branch values (*lazy action*)
-   /// \tparam T The type of the branch.
-   /// \param[in] branchName The name of the branch to be treated.
-   ///
-   /// If no branch type is specified, the implementation will try to guess one.
-   ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T = double>
-   TActionResultProxy<double> Min(const std::string &branchName = "")
+   template <int... S, typename... BranchTypes>
+   void UpdateBlockHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
+                          Internal::TDFTraitsUtils::TStaticSeq<S...>, unsigned int slot,
+                          const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel)
    {
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "calculate the minumum");
-      auto minV = std::make_shared<T>(std::numeric_limits<T>::max());
-      return CreateAction<T, Internal::EActionType::kMin>(theBranchName, minV);
+      EvalBlock(fSlotStates[slot].fBlockValues, sel,
+                Internal::GetBlockValues<BranchTypes>(fBlockColumns[slot][S], fTmpBranchPtrs[slot][S], slot, block,
+                                                      sel)...);
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return the maximum of processed branch values (*lazy action*)
-   /// \tparam T The type of the branch.
-   /// \param[in] branchName The name of the branch to be treated.
-   ///
-   /// If no branch type is specified, the implementation will try to guess one.
-   ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T = double>
-   TActionResultProxy<double> Max(const std::string &branchName = "")
+   /// Evaluate the expression at the selected positions of a block
+   template <typename... Ts>
+   void EvalBlock(Internal::TBlockValues<RetType_t> &values, const Internal::TBlockSelection_t &sel, Ts *... vs)
    {
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "calculate the maximum");
-      auto maxV = std::make_shared<T>(std::numeric_limits<T>::min());
-      return CreateAction<T, Internal::EActionType::kMax>(theBranchName, maxV);
+      for (auto pos : sel) values.Set(pos, fExpression(vs[pos]...));
+   }
+};
+
+class TDataFrameFilterBase {
+public:
+   virtual ~TDataFrameFilterBase() {}
+   virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
+   virtual void CreateSlots(unsigned int nSlots) = 0;
+   /// Evaluate this filter alone, at most once per entry and slot
+   virtual bool EvalFilterOnce(unsigned int slot, int entry) = 0;
+   /// Check the filters upstream of this one
+   virtual bool CheckPrevFilters(unsigned int slot, int entry) = 0;
+   /// Evaluate this filter alone on the selected entries of a block, without caching the results
+   virtual void EvalBlock(unsigned int slot, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel,
+                          Internal::TBlockSelection_t &passed) = 0;
+   /// Evaluate this filter alone on the selected entries of a block, at most once per entry and slot
+   virtual void EvalBlockOnce(unsigned int slot, const Internal::TEntryBlock &block,
+                              const Internal::TBlockSelection_t &sel, Internal::TBlockSelection_t &passed) = 0;
+   /// Check the entries of a block against the filters upstream of this one
+   virtual const Internal::TBlockSelection_t &CheckPrevBlock(unsigned int slot, const Internal::TEntryBlock &block) = 0;
+   virtual TDataFrameFilterBase *GetParentFilter() = 0;
+   /// The filter right upstream of this one, if nothing but filters lies in between
+   virtual TDataFrameFilterBase *GetChainedParent() = 0;
+   /// Evaluate this filter in declaration order in all chains, so that its counters describe the cut flow
+   virtual void SetReported() = 0;
+   virtual bool IsReported() const = 0;
+   /// Add the entries counted by this filter during the last event loop to the report
+   virtual void FillReport(TCutFlowReport &report) const = 0;
+   /// Add the time spent evaluating this filter during the last event loop, if profiled, to the profile
+   virtual void AddProfile(TDataFrameProfile &profile) const = 0;
+};
+using FilterBasePtr_t = std::shared_ptr<TDataFrameFilterBase>;
+using FilterBaseVec_t = std::vector<FilterBasePtr_t>;
+
+template <typename FilterF, typename PrevDataFrame>
+class TDataFrameFilter final : public TDataFrameFilterBase {
+   using BranchTypes_t = typename Internal::TDFTraitsUtils::TFunctionTraits<FilterF>::ArgTypes_t;
+   using TypeInd_t = typename Internal::TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
+
+   /// The state of a slot: the last entry checked and the result of the check, the last entry this
+   /// filter alone was evaluated on and its result, the entries it accepted and rejected, and the
+   /// statistics of the chain ending with this filter. In batched mode, the same for the last block.
+   struct TSlotState {
+      int fLastCheckedEntry = -1;
+      bool fLastResult = true;
+      int fLastEvaluatedEntry = -1;
+      bool fLastOwnResult = true;
+      ULong64_t fCheckedBlock = 0;
+      Internal::TBlockSelection_t fBlockSelection; ///< The entries of the block passing this filter and those upstream
+      ULong64_t fEvaluatedBlock = 0;
+      std::vector<signed char> fOwnResults; ///< Result of this filter alone at each position of the block, -1 if unknown
+      Internal::TBlockSelection_t fMissing; ///< The requested positions this filter was not evaluated at yet
+      Internal::TBlockSelection_t fPassed;  ///< Scratch selections
+      Internal::TBlockSelection_t fScratch;
+      ULong64_t fNAccepted = 0;         ///< Entries this filter alone was evaluated on, and passed
+      ULong64_t fNRejected = 0;         ///< Entries this filter alone was evaluated on, and failed
+      unsigned int fNSampled = 0;       ///< Entries on which all the filters of the chain were timed
+      std::vector<double> fCosts;       ///< Time spent evaluating each filter of the chain, in seconds
+      std::vector<ULong64_t> fNPassed;  ///< Sampled entries that passed each filter of the chain
+      std::vector<unsigned int> fOrder; ///< Order in which the filters of the chain are evaluated
+   };
+
+   /// Entries sampled by each slot before the filters of the chain are reordered
+   static constexpr unsigned int fgNSampledEntries = 1000;
+
+   FilterF fFilter;
+   const BranchNames fBranches;
+   const BranchNames fTmpBranches;
+   PrevDataFrame *fPrevData;
+   std::weak_ptr<TDataFrameImpl> fFirstData;
+   const std::string fName;
+   bool fIsReported = false;
+   std::vector<Internal::TVBVec_t> fReaderValues = {};
+   std::vector<std::vector<void *>> fBlockColumns; ///< The arrays of the real branches, in batched mode
+   std::vector<Internal::TmpBranchPtrVec_t> fTmpBranchPtrs = {};
+   Internal::TSlotStorage<TSlotState> fSlotStates;
+   Internal::ProfileStorage_t fProfileCounters;          ///< Empty unless the event loop is profiled
+   Internal::ProfileStorage_t *fLoadCounters = nullptr; ///< The reader loads of the data frame, if profiled
+   /// The filters that commute with this one, in the order they were declared, this one last.
+   /// Empty unless filters are reordered and at least one filter lies right upstream of this one
+   std::vector<TDataFrameFilterBase *> fChain;
+   bool fIsReordered = false; ///< Whether filters are reordered: then several chains may evaluate this filter
+   unsigned int fNChildren = 0;                  ///< Number of nodes downstream that lead to booked actions
+   std::atomic<unsigned int> fNStopsReceived{0}; ///< Number of nodes downstream that stopped processing entries
+
+   /// Check the entry against the filters upstream of the chain, then against the filters of the chain
+   bool CheckChain(TSlotState &state, unsigned int slot, int entry)
+   {
+      if (!fChain.front()->CheckPrevFilters(slot, entry)) return false;
+      if (state.fNSampled < fgNSampledEntries) return SampleChain(state, slot, entry);
+      for (auto i : state.fOrder)
+         if (!fChain[i]->EvalFilterOnce(slot, entry)) return false;
+      return true;
    }
 
-   ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return the mean of processed branch values (*lazy action*)
-   /// \tparam T The type of the branch.
-   /// \param[in] branchName The name of the branch to be treated.
-   ///
-   /// If no branch type is specified, the implementation will try to guess one.
-   ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T = double>
-   TActionResultProxy<double> Mean(const std::string &branchName = "")
+   /// Evaluate and time all the filters of the chain, so that the pass rate of a filter does not
+   /// depend on the filters evaluated before it
+   bool SampleChain(TSlotState &state, unsigned int slot, int entry)
    {
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "calculate the mean");
-      auto meanV = std::make_shared<T>(0);
-      return CreateAction<T, Internal::EActionType::kMean>(theBranchName, meanV);
+      bool result = true;
+      for (unsigned int i = 0; i < fChain.size(); ++i) {
+         const auto start = std::chrono::steady_clock::now();
+         const bool passed = fChain[i]->EvalFilterOnce(slot, entry);
+         state.fCosts[i] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         state.fNPassed[i] += passed;
+         result = result && passed;
+      }
+      if (++state.fNSampled == fgNSampledEntries) SortChain(state);
+      return result;
    }
 
-private:
-   TDataFrameInterface(std::shared_ptr<Proxied> proxied) : fProxiedPtr(proxied) {}
+   /// The batched counterpart of CheckChain: the selection of the block shrinks filter after filter
+   void CheckChainBlock(TSlotState &state, unsigned int slot, const Internal::TEntryBlock &block)
+   {
+      const auto &prevSel = fChain.front()->CheckPrevBlock(slot, block);
+      if (state.fNSampled < fgNSampledEntries) {
+         SampleChainBlock(state, slot, block, prevSel);
+         return;
+      }
+      auto &sel = state.fBlockSelection;
+      const Internal::TBlockSelection_t *in = &prevSel;
+      for (auto i : state.fOrder) {
+         fChain[i]->EvalBlockOnce(slot, block, *in, state.fScratch);
+         std::swap(sel, state.fScratch);
+         in = &sel;
+         if (sel.empty()) break;
+      }
+   }
 
-   /// Get the TDataFrameImpl if reachable. If not, throw.
-   std::shared_ptr<Details::TDataFrameImpl> GetDataFrameChecked()
+   /// The batched counterpart of SampleChain: all the filters of the chain are evaluated and timed on
+   /// all the entries of the block that pass the filters upstream of the chain
+   void SampleChainBlock(TSlotState &state, unsigned int slot, const Internal::TEntryBlock &block,
+                         const Internal::TBlockSelection_t &prevSel)
    {
-      auto df = fProxiedPtr->GetDataFrame().lock();
-      if (!df) {
-         throw std::runtime_error("The main TDataFrame is not reachable: did it go out of scope?");
+      auto &sel = state.fBlockSelection;
+      sel = prevSel;
+      for (unsigned int i = 0; i < fChain.size(); ++i) {
+         const auto start = std::chrono::steady_clock::now();
+         fChain[i]->EvalBlockOnce(slot, block, prevSel, state.fPassed);
+         state.fCosts[i] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+         state.fNPassed[i] += state.fPassed.size();
+         state.fScratch.clear();
+         std::set_intersection(sel.begin(), sel.end(), state.fPassed.begin(), state.fPassed.end(),
+                               std::back_inserter(state.fScratch));
+         std::swap(sel, state.fScratch);
       }
-      return df;
+      state.fNSampled += prevSel.size();
+      if (state.fNSampled >= fgNSampledEntries) SortChain(state);
    }
 
-   void GetDefaultBranchName(std::string &theBranchName, const std::string &actionNameForErr)
+   /// Order the filters of the chain by increasing cost per rejected entry
+   void SortChain(TSlotState &state)
    {
-      if (theBranchName.empty()) {
-         // Try the default branch if possible
-         auto df = GetDataFrameChecked();
-         const BranchNames &defBl = df->GetDefaultBranches();
-         if (defBl.size() == 1) {
-            theBranchName = defBl[0];
-         } else {
-            std::string msg("No branch in input to ");
-            msg += actionNameForErr;
-            msg += " and default branch list has size ";
-            msg += std::to_string(defBl.size());
-            msg += ", need 1";
-            throw std::runtime_error(msg);
-         }
+      std::vector<double> ranks(fChain.size());
+      for (unsigned int i = 0; i < fChain.size(); ++i) {
+         const double rejectRate = 1. - double(state.fNPassed[i]) / state.fNSampled;
+         ranks[i] = rejectRate > 0. ? state.fCosts[i] / rejectRate : std::numeric_limits<double>::max();
       }
+      std::stable_sort(state.fOrder.begin(), state.fOrder.end(),
+                       [&ranks](unsigned int a, unsigned int b) { return ranks[a] < ranks[b]; });
    }
 
-   template <typename BranchType, typename ActionResultType, enum Internal::EActionType, typename ThisType>
-   struct SimpleAction {};
+public:
+   TDataFrameFilter(FilterF f, const BranchNames &bl, std::shared_ptr<PrevDataFrame> pd, const std::string &name = "")
+      : fFilter(f), fBranches(bl), fTmpBranches(pd->GetTmpBranches()), fPrevData(pd.get()),
+        fFirstData(pd->GetDataFrame()), fName(name) { }
 
-   template <typename BranchType, typename ThisType>
-   struct SimpleAction<BranchType, TH1F, Internal::EActionType::kHisto1D, ThisType> {
-      static TActionResultProxy<TH1F> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
-                                                 std::shared_ptr<TH1F> h, unsigned int nSlots)
-      {
-         // we use a shared_ptr so that the operation has the same scope of the lambda
-         // and therefore of the TDataFrameAction that contains it: merging of results
-         // from different threads is performed in the operation's destructor, at the
-         // moment when the TDataFrameAction is deleted by TDataFrameImpl
-         BranchNames bl = {theBranchName};
-         auto df = thisFrame->GetDataFrameChecked();
-         auto xaxis = h->GetXaxis();
-         auto hasAxisLimits = !(xaxis->GetXmin() == 0. && xaxis->GetXmax() == 0.);
+   std::weak_ptr<TDataFrameImpl> GetDataFrame() const { return fFirstData; }
 
-         if (hasAxisLimits) {
-            auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation>(h, nSlots);
-            auto fillLambda = [fillTOOp](unsigned int slot, const BranchType &v) mutable { fillTOOp->Exec(v, slot); };
-            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
-            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+   BranchNames GetTmpBranches() const { return fTmpBranches; }
+
+   TDataFrameFilter(const TDataFrameFilter &) = delete;
+
+   bool CheckFilters(unsigned int slot, int entry)
+   {
+      auto &state = fSlotStates[slot];
+      if (entry != state.fLastCheckedEntry) {
+         if (!fChain.empty()) {
+            // the filters of the chain commute: evaluate them in the order measured to be the fastest
+            state.fLastResult = CheckChain(state, slot, entry);
+         } else if (!fPrevData->CheckFilters(slot, entry)) {
+            // a filter upstream returned false, cache the result
+            state.fLastResult = false;
          } else {
-            auto fillOp = std::make_shared<Internal::Operations::FillOperation>(h, nSlots);
-            auto fillLambda = [fillOp](unsigned int slot, const BranchType &v) mutable { fillOp->Exec(v, slot); };
-            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
-            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+            // evaluate this filter, cache the result
+            state.fLastResult = EvalFilterOnce(slot, entry);
          }
-         return df->MakeActionResultPtr(h);
+         state.fLastCheckedEntry = entry;
       }
-   };
+      return state.fLastResult;
+   }
 
-   template <typename BranchType, typename ThisType, typename ActionResultType>
-   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kMin, ThisType> {
-      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
-                                                             std::shared_ptr<ActionResultType> minV, unsigned int nSlots)
-      {
-         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
-         auto minOp = std::make_shared<Internal::Operations::MinOperation>(minV.get(), nSlots);
-         auto minOpLambda = [minOp](unsigned int slot, const BranchType &v) mutable { minOp->Exec(v, slot); };
-         BranchNames bl = {theBranchName};
-         using DFA_t = Internal::TDataFrameAction<decltype(minOpLambda), Proxied>;
-         auto df = thisFrame->GetDataFrameChecked();
-         df->Book(std::make_shared<DFA_t>(minOpLambda, bl, thisFrame->fProxiedPtr));
-         return df->MakeActionResultPtr(minV);
+   bool EvalFilter(unsigned int slot, int entry)
+   {
+      Internal::TProfileTimer timer(Internal::GetSlotCounters(fProfileCounters, slot));
+      return CheckFilterHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
+   }
+
+   bool EvalFilterOnce(unsigned int slot, int entry)
+   {
+      auto &state = fSlotStates[slot];
+      if (entry != state.fLastEvaluatedEntry) {
+         state.fLastOwnResult = EvalFilter(slot, entry);
+         state.fLastEvaluatedEntry = entry;
+         if (state.fLastOwnResult) ++state.fNAccepted;
+         else ++state.fNRejected;
       }
-   };
+      return state.fLastOwnResult;
+   }
 
-   template <typename BranchType, typename ThisType, typename ActionResultType>
-   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kMax, ThisType> {
-      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
-                                                             std::shared_ptr<ActionResultType> maxV, unsigned int nSlots)
-      {
-         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
-         auto maxOp = std::make_shared<Internal::Operations::MaxOperation>(maxV.get(), nSlots);
-         auto maxOpLambda = [maxOp](unsigned int slot, const BranchType &v) mutable { maxOp->Exec(v, slot); };
-         BranchNames bl = {theBranchName};
-         using DFA_t = Internal::TDataFrameAction<decltype(maxOpLambda), Proxied>;
-         auto df = thisFrame->GetDataFrameChecked();
-         df->Book(std::make_shared<DFA_t>(maxOpLambda, bl, thisFrame->fProxiedPtr));
-         return df->MakeActionResultPtr(maxV);
+   bool CheckPrevFilters(unsigned int slot, int entry) { return fPrevData->CheckFilters(slot, entry); }
+
+   const Internal::TBlockSelection_t &CheckBlock(unsigned int slot, const Internal::TEntryBlock &block)
+   {
+      auto &state = fSlotStates[slot];
+      if (block.fId != state.fCheckedBlock) {
+         if (!fChain.empty())
+            CheckChainBlock(state, slot, block);
+         else
+            EvalBlockOnce(slot, block, fPrevData->CheckBlock(slot, block), state.fBlockSelection);
+         state.fCheckedBlock = block.fId;
       }
-   };
+      return state.fBlockSelection;
+   }
 
-   template <typename BranchType, typename ThisType, typename ActionResultType>
-   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kMean, ThisType> {
-      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
-                                                             std::shared_ptr<ActionResultType> meanV, unsigned int nSlots)
+   /// Evaluate this filter on the selected entries of a block, and count the entries it accepts and rejects
+   void EvalBlock(unsigned int slot, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel,
+                  Internal::TBlockSelection_t &passed)
+   {
       {
-         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
-         auto meanOp = std::make_shared<Internal::Operations::MeanOperation>(meanV.get(), nSlots);
-         auto meanOpLambda = [meanOp](unsigned int slot, const BranchType &v) mutable { meanOp->Exec(v, slot); };
-         BranchNames bl = {theBranchName};
-         using DFA_t = Internal::TDataFrameAction<decltype(meanOpLambda), Proxied>;
-         auto df = thisFrame->GetDataFrameChecked();
-         df->Book(std::make_shared<DFA_t>(meanOpLambda, bl, thisFrame->fProxiedPtr));
-         return df->MakeActionResultPtr(meanV);
+         Internal::TProfileTimer timer(Internal::GetSlotCounters(fProfileCounters, slot), sel.size());
+         passed.resize(sel.size());
+         passed.resize(EvalBlockHelper(BranchTypes_t(), TypeInd_t(), slot, block, sel, passed.data()));
       }
-   };
+      auto &state = fSlotStates[slot];
+      state.fNAccepted += passed.size();
+      state.fNRejected += sel.size() - passed.size();
+   }
 
-   template <typename BranchType, Internal::EActionType ActionType, typename ActionResultType>
-   TActionResultProxy<ActionResultType> CreateAction(const std::string & theBranchName,
-                                                   std::shared_ptr<ActionResultType> r)
+   void EvalBlockOnce(unsigned int slot, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel,
+                      Internal::TBlockSelection_t &passed)
    {
-      // More types can be added at will at the cost of some compilation time and size of binaries.
-      using ART_t = ActionResultType;
-      using TT_t = decltype(this);
-      const auto at = ActionType;
-      auto df = GetDataFrameChecked();
-      auto tree = static_cast<TTree*>(df->GetDirectory()->Get(df->GetTreeName().c_str()));
-      auto branch = tree->GetBranch(theBranchName.c_str());
-      unsigned int nSlots = df->GetNSlots();
-      if (!branch) {
-         // temporary branch
-         const auto &type_id = df->GetBookedBranch(theBranchName).GetTypeId();
-         if (type_id == typeid(char)) {
-            return SimpleAction<char, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         } else if (type_id == typeid(int)) {
-            return SimpleAction<int, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         } else if (type_id == typeid(double)) {
-            return SimpleAction<double, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         } else if (type_id == typeid(double)) {
-            return SimpleAction<double, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         } else if (type_id == typeid(std::vector<double>)) {
-            return SimpleAction<std::vector<double>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         } else if (type_id == typeid(std::vector<float>)) {
-            return SimpleAction<std::vector<float>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         }
+      // unless filters are reordered, this filter is only evaluated by CheckBlock, once per block
+      if (!fIsReordered) {
+         EvalBlock(slot, block, sel, passed);
+         return;
       }
-      // real branch
-      auto branchEl = dynamic_cast<TBranchElement *>(branch);
-      if (!branchEl) { // This is a fundamental type
-         auto title    = branch->GetTitle();
-         auto typeCode = title[strlen(title) - 1];
-         if (typeCode == 'B') {
-            return SimpleAction<char, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         }
-         // else if (typeCode == 'b') { return SimpleAction<Uchar, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         // else if (typeCode == 'S') { return SimpleAction<Short_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         // else if (typeCode == 's') { return SimpleAction<UShort_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         else if (typeCode == 'I') {
-            return SimpleAction<int, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         }
-         // else if (typeCode == 'i') { return SimpleAction<unsigned int , ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         // else if (typeCode == 'F') { return SimpleAction<float, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         else if (typeCode == 'D') {
-            return SimpleAction<double, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         }
-         // else if (typeCode == 'L') { return SimpleAction<Long64_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         // else if (typeCode == 'l') { return SimpleAction<ULong64_t, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots); }
-         else if (typeCode == 'O') {
-            return SimpleAction<bool, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         }
+      auto &state = fSlotStates[slot];
+      auto &results = state.fOwnResults;
+      if (block.fId != state.fEvaluatedBlock) {
+         std::fill(results.begin(), results.end(), -1);
+         state.fEvaluatedBlock = block.fId;
+      }
+      auto &missing = state.fMissing;
+      missing.clear();
+      for (auto pos : sel)
+         if (results[pos] < 0) missing.emplace_back(pos);
+      if (!missing.empty()) {
+         EvalBlock(slot, block, missing, state.fPassed);
+         for (auto pos : missing) results[pos] = 0;
+         for (auto pos : state.fPassed) results[pos] = 1;
+      }
+      passed.clear();
+      for (auto pos : sel)
+         if (results[pos] == 1) passed.emplace_back(pos);
+   }
+
+   const Internal::TBlockSelection_t &CheckPrevBlock(unsigned int slot, const Internal::TEntryBlock &block)
+   {
+      return fPrevData->CheckBlock(slot, block);
+   }
+
+   bool CanProcessBlocks() const
+   {
+      return Internal::CanReadBlocks(BranchTypes_t()) && fPrevData->CanProcessBlocks();
+   }
+
+   TDataFrameFilterBase *GetFilterAncestor() { return this; }
+
+   TDataFrameFilterBase *GetParentFilter() { return fPrevData->GetFilterAncestor(); }
+
+   // filters downstream commute with this one
+   TDataFrameFilterBase *GetChainedFilter() { return this; }
+
+   TDataFrameFilterBase *GetChainedParent() { return fPrevData->GetChainedFilter(); }
+
+   void SetReported() { fIsReported = true; }
+
+   bool IsReported() const { return fIsReported; }
+
+   void FillReport(TCutFlowReport &report) const
+   {
+      ULong64_t accepted = 0, rejected = 0;
+      for (auto &state : fSlotStates) {
+         accepted += state.fNAccepted;
+         rejected += state.fNRejected;
+      }
+      report.AddCut(fName, accepted + rejected, accepted);
+   }
+
+   void AddProfile(TDataFrameProfile &profile) const
+   {
+      if (fProfileCounters.size() == 0) return;
+      const auto sum = Internal::SumCounters(fProfileCounters);
+      profile.AddNode("filter", fName, sum.fNCalls, sum.fTime);
+   }
+
+   template <int... S, typename... BranchTypes>
+   bool CheckFilterHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
+                          Internal::TDFTraitsUtils::TStaticSeq<S...>,
+                          unsigned int slot, int entry)
+   {
+      // Take each pointer in tvb, cast it to a pointer to the
+      // correct specialization of TTreeReaderValue, and get its content.
+      // S expands to a sequence of integers 0 to sizeof...(types)-1
+      // S and types are expanded simultaneously by "..."
+      return fFilter(Internal::GetBranchValue<S, BranchTypes>(fReaderValues[slot][S], fTmpBranchPtrs[slot][S], slot,
+                                                              entry,
+                                                              Internal::GetSlotCounters(fLoadCounters, slot))...);
+   }
+
+   template <int... S, typename... BranchTypes>
+   std::size_t EvalBlockHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
+                               Internal::TDFTraitsUtils::TStaticSeq<S...>, unsigned int slot,
+                               const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel,
+                               unsigned int *passed)
+   {
+      return Internal::SelectBlock(fFilter, sel, passed,
+                                   Internal::GetBlockValues<BranchTypes>(fBlockColumns[slot][S], fTmpBranchPtrs[slot][S],
+                                                                         slot, block, sel)...);
+   }
+
+   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+   {
+      auto df = fFirstData.lock();
+      const auto batchSize = Internal::GetLoopBatchSize(*df);
+      if (batchSize > 0) {
+         // the values of the branches read in batched mode are copied at every entry: a node that leads to no
+         // booked action reads none
+         if (fNChildren > 0)
+            fBlockColumns[slot] =
+               Internal::BuildBlockColumns(*df, r, slot, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+         fSlotStates[slot].fOwnResults.assign(batchSize, -1);
       } else {
-         std::string typeName = branchEl->GetTypeName();
-         if (typeName == "vector<double>") {
-            return SimpleAction<std::vector<double>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         } else if (typeName == "vector<float>") {
-            return SimpleAction<std::vector<float>, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
-         }
+         fReaderValues[slot] = Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
       }
-      return SimpleAction<BranchType, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
+      fTmpBranchPtrs[slot] = Internal::BuildTmpBranchPtrs(*df, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      // entry numbers start over in every file: forget the entries checked by the previous reader of this slot
+      fSlotStates[slot].fLastCheckedEntry = -1;
+      fSlotStates[slot].fLastEvaluatedEntry = -1;
    }
 
-   std::shared_ptr<Proxied> fProxiedPtr;
-};
+   void CreateSlots(unsigned int nSlots)
+   {
+      fReaderValues.resize(nSlots);
+      fBlockColumns.resize(nSlots);
+      fTmpBranchPtrs.resize(nSlots);
+      fSlotStates.Reset(nSlots);
+      Internal::SetUpProfiling(*fFirstData.lock(), nSlots, fProfileCounters, fLoadCounters);
+      fChain.clear();
+      fIsReordered = fPrevData->GetDataFrame().lock()->GetFilterReordering();
+      if (fIsReordered) {
+         for (TDataFrameFilterBase *f = this; f; f = f->GetChainedParent()) fChain.insert(fChain.begin(), f);
+         // the counters of a reported filter are only meaningful if no filter downstream of it is moved before it
+         const bool isReported =
+            std::any_of(fChain.begin(), fChain.end(), [](TDataFrameFilterBase *f) { return f->IsReported(); });
+         if (fChain.size() == 1 || isReported) fChain.clear();
+      }
+      for (auto &state : fSlotStates) {
+         state.fCosts.assign(fChain.size(), 0.);
+         state.fNPassed.assign(fChain.size(), 0ull);
+         state.fOrder.resize(fChain.size());
+         for (unsigned int i = 0; i < fChain.size(); ++i) state.fOrder[i] = i;
+      }
+      fNChildren = 0;
+      fNStopsReceived = 0;
+   }
 
-using TDataFrame = TDataFrameInterface<ROOT::Details::TDataFrameImpl>;
+   void AddReadBranches(BranchNames &readSet) const
+   {
+      Internal::AddRealBranches(fBranches, fTmpBranches, readSet);
+      fPrevData->AddReadBranches(readSet);
+   }
 
-namespace Details {
+   void IncrChildrenCount()
+   {
+      // the first child leading to actions makes this node relevant for the previous one
+      if (++fNChildren == 1) fPrevData->IncrChildrenCount();
+   }
 
-class TDataFrameBranchBase {
-public:
-   virtual ~TDataFrameBranchBase() {}
-   virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
-   virtual void CreateSlots(unsigned int nSlots) = 0;
-   virtual std::string GetName() const       = 0;
-   virtual void *GetValue(unsigned int slot, int entry) = 0;
-   virtual const std::type_info &GetTypeId() const = 0;
+   void StopProcessing()
+   {
+      // no entry will reach the nodes downstream anymore: neither will it reach this one
+      if (++fNStopsReceived == fNChildren) fPrevData->StopProcessing();
+   }
 };
-using TmpBranchBasePtr_t = std::shared_ptr<TDataFrameBranchBase>;
 
-template <typename F, typename PrevData>
-class TDataFrameBranch final : public TDataFrameBranchBase {
-   using BranchTypes_t = typename Internal
-   ::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t;
-   using TypeInd_t = typename Internal::TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
-   using RetType_t = typename Internal::TDFTraitsUtils::TFunctionTraits<F>::RetType_t;
+/// A node that lets through a range of the entries that reach it, i.e. that pass all upstream filters.
+/// The n-th entry reaching the node passes if n is in [begin, end) and n - begin is a multiple of stride.
+/// Once no more entries can pass, the node informs the nodes upstream, so that the event loop
+/// stops as soon as no booked action can receive entries anymore.
+/// In parallel runs entries are counted across all slots, in the order they are processed: every
+/// entry costs an atomic increment of a counter shared by the threads. With one slot the counter
+/// is only read and written by that slot.
+template <typename PrevData>
+class TDataFrameRange final : public TDataFrameFilterBase {
+   /// The state of a slot: the last entry checked and the result of the check, or the last block checked
+   /// and the entries of the block that passed
+   struct TSlotState {
+      int fLastCheckedEntry = -1;
+      bool fLastResult = true;
+      ULong64_t fCheckedBlock = 0;
+      Internal::TBlockSelection_t fBlockSelection;
+   };
 
-   const std::string fName;
-   F fExpression;
-   const BranchNames fBranches;
-   BranchNames fTmpBranches;
-   std::vector<ROOT::Internal::TVBVec_t> fReaderValues;
-   std::vector<std::shared_ptr<RetType_t>> fLastResultPtr;
-   std::weak_ptr<TDataFrameImpl> fFirstData;
+   const ULong64_t fBegin;
+   const ULong64_t fEnd; ///< 0 if the range goes until the end of the data-set
+   const unsigned int fStride;
+   const BranchNames fTmpBranches;
    PrevData *fPrevData;
-   std::vector<int> fLastCheckedEntry = {-1};
+   std::weak_ptr<TDataFrameImpl> fFirstData;
+   Internal::TSlotStorage<TSlotState> fSlotStates;
+   std::atomic<ULong64_t> fNProcessed{0}; ///< Number of entries that reached this node, in all slots
+   bool fIsShared = false;                ///< Whether several slots update fNProcessed
+   std::atomic<bool> fHasStopped{false};
+   unsigned int fNChildren = 0;                  ///< Number of nodes downstream that lead to booked actions
+   std::atomic<unsigned int> fNStopsReceived{0}; ///< Number of nodes downstream that stopped processing entries
+
+   bool EvalRange()
+   {
+      // a plain load and store avoid the locked read-modify-write when no other slot counts entries
+      const auto n =
+         fIsShared ? fNProcessed.fetch_add(1, std::memory_order_relaxed) : fNProcessed.load(std::memory_order_relaxed);
+      if (!fIsShared) fNProcessed.store(n + 1, std::memory_order_relaxed);
+      if (fEnd > 0 && n + 1 >= fEnd) Stop();
+      if (n < fBegin || (fEnd > 0 && n >= fEnd)) return false;
+      return (n - fBegin) % fStride == 0;
+   }
 
-public:
-   TDataFrameBranch(const std::string &name, F expression, const BranchNames &bl, std::shared_ptr<PrevData> pd)
-      : fName(name), fExpression(expression), fBranches(bl), fTmpBranches(pd->GetTmpBranches()),
-        fFirstData(pd->GetDataFrame()), fPrevData(pd.get())
+   void Stop()
    {
-      fTmpBranches.emplace_back(name);
+      // nodes upstream are informed once, and only if they counted this node as a child
+      if (fNChildren > 0 && !fHasStopped.exchange(true)) fPrevData->StopProcessing();
    }
 
-   TDataFrameBranch(const TDataFrameBranch &) = delete;
+public:
+   TDataFrameRange(ULong64_t begin, ULong64_t end, unsigned int stride, std::shared_ptr<PrevData> pd)
+      : fBegin(begin), fEnd(end), fStride(stride), fTmpBranches(pd->GetTmpBranches()), fPrevData(pd.get()),
+        fFirstData(pd->GetDataFrame()) { }
+
+   TDataFrameRange(const TDataFrameRange &) = delete;
 
    std::weak_ptr<TDataFrameImpl> GetDataFrame() const { return fFirstData; }
 
    BranchNames GetTmpBranches() const { return fTmpBranches; }
 
-   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+   bool CheckFilters(unsigned int slot, int entry)
+   {
+      auto &state = fSlotStates[slot];
+      if (entry != state.fLastCheckedEntry) {
+         // entries are counted only if they pass the upstream filters
+         state.fLastResult = fPrevData->CheckFilters(slot, entry) && EvalRange();
+         state.fLastCheckedEntry = entry;
+      }
+      return state.fLastResult;
+   }
+
+   // ranges count the entries that reach them: they are never part of a chain of commuting filters
+   bool EvalFilterOnce(unsigned int, int) { return EvalRange(); }
+
+   bool CheckPrevFilters(unsigned int slot, int entry) { return fPrevData->CheckFilters(slot, entry); }
+
+   const Internal::TBlockSelection_t &CheckBlock(unsigned int slot, const Internal::TEntryBlock &block)
+   {
+      auto &state = fSlotStates[slot];
+      if (block.fId != state.fCheckedBlock) {
+         EvalBlockOnce(slot, block, fPrevData->CheckBlock(slot, block), state.fBlockSelection);
+         state.fCheckedBlock = block.fId;
+      }
+      return state.fBlockSelection;
+   }
+
+   // the entries of the block are counted in order
+   void EvalBlock(unsigned int, const Internal::TEntryBlock &, const Internal::TBlockSelection_t &sel,
+                  Internal::TBlockSelection_t &passed)
+   {
+      passed.clear();
+      for (auto pos : sel)
+         if (EvalRange()) passed.emplace_back(pos);
+   }
+
+   void EvalBlockOnce(unsigned int slot, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &sel,
+                      Internal::TBlockSelection_t &passed)
    {
-      fReaderValues[slot] = Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      EvalBlock(slot, block, sel, passed);
    }
 
-   void *GetValue(unsigned int slot, int entry)
+   const Internal::TBlockSelection_t &CheckPrevBlock(unsigned int slot, const Internal::TEntryBlock &block)
    {
-      if (entry != fLastCheckedEntry[slot]) {
-         // evaluate this filter, cache the result
-         auto newValuePtr = GetValueHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
-         fLastResultPtr[slot] = newValuePtr;
-         fLastCheckedEntry[slot] = entry;
-      }
-      return static_cast<void *>(fLastResultPtr[slot].get());
+      return fPrevData->CheckBlock(slot, block);
    }
 
-   const std::type_info &GetTypeId() const { return typeid(RetType_t); }
+   bool CanProcessBlocks() const { return fPrevData->CanProcessBlocks(); }
 
-   void CreateSlots(unsigned int nSlots)
+   TDataFrameFilterBase *GetFilterAncestor() { return this; }
+
+   TDataFrameFilterBase *GetParentFilter() { return fPrevData->GetFilterAncestor(); }
+
+   TDataFrameFilterBase *GetChainedFilter() { return nullptr; }
+
+   TDataFrameFilterBase *GetChainedParent() { return nullptr; }
+
+   // the entries a range lets through only depend on the entries reaching it
+   void SetReported() {}
+
+   bool IsReported() const { return false; }
+
+   // ranges are not cuts: they do not appear in reports
+   void FillReport(TCutFlowReport &) const {}
+
+   // counting entries is not worth profiling
+   void AddProfile(TDataFrameProfile &) const {}
+
+   void BuildReaderValues(TTreeReader &, unsigned int slot)
    {
-      fReaderValues.resize(nSlots);
-      fLastCheckedEntry.resize(nSlots);
-      fLastResultPtr.resize(nSlots);
+      // entry numbers start over in every file: forget the entry checked by the previous reader of this slot
+      fSlotStates[slot].fLastCheckedEntry = -1;
    }
 
-   bool CheckFilters(unsigned int slot, int entry)
+   void CreateSlots(unsigned int nSlots)
    {
-      // dummy call: it just forwards to the previous object in the chain
-      return fPrevData->CheckFilters(slot, entry);
+      fSlotStates.Reset(nSlots);
+      fNProcessed = 0;
+      fIsShared = nSlots > 1;
+      fHasStopped = false;
+      fNChildren = 0;
+      fNStopsReceived = 0;
    }
 
-   std::string GetName() const { return fName; }
+   void AddReadBranches(BranchNames &readSet) const { fPrevData->AddReadBranches(readSet); }
 
-   template <int... S, typename... BranchTypes>
-   std::shared_ptr<RetType_t> GetValueHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
-                                             Internal::TDFTraitsUtils::TStaticSeq<S...>,
-                                             unsigned int slot, int entry)
+   void IncrChildrenCount()
    {
-      auto valuePtr = std::make_shared<RetType_t>(fExpression(
-         Internal::GetBranchValue<S, BranchTypes>(fReaderValues[slot][S], slot, entry, fBranches[S], fFirstData)...));
-      return valuePtr;
+      // the first child leading to actions makes this node relevant for the previous one
+      if (++fNChildren == 1) fPrevData->IncrChildrenCount();
    }
-};
 
-class TDataFrameFilterBase {
-public:
-   virtual ~TDataFrameFilterBase() {}
-   virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
-   virtual void CreateSlots(unsigned int nSlots) = 0;
+   void StopProcessing()
+   {
+      // all the nodes downstream stopped: this range will not let any more entries through either
+      if (++fNStopsReceived == fNChildren) Stop();
+   }
 };
-using FilterBasePtr_t = std::shared_ptr<TDataFrameFilterBase>;
-using FilterBaseVec_t = std::vector<FilterBasePtr_t>;
-
-template <typename FilterF, typename PrevDataFrame>
-class TDataFrameFilter final : public TDataFrameFilterBase {
-   using BranchTypes_t = typename Internal::TDFTraitsUtils::TFunctionTraits<FilterF>::ArgTypes_t;
-   using TypeInd_t = typename Internal::TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
-
-   FilterF fFilter;
-   const BranchNames fBranches;
-   const BranchNames fTmpBranches;
-   PrevDataFrame *fPrevData;
-   std::weak_ptr<TDataFrameImpl> fFirstData;
-   std::vector<Internal::TVBVec_t> fReaderValues = {};
-   std::vector<int> fLastCheckedEntry = {-1};
-   std::vector<int> fLastResult = {true}; // std::vector<bool> cannot be used in a MT context safely
-
-public:
-   TDataFrameFilter(FilterF f, const BranchNames &bl, std::shared_ptr<PrevDataFrame> pd)
-      : fFilter(f), fBranches(bl), fTmpBranches(pd->GetTmpBranches()), fPrevData(pd.get()),
-        fFirstData(pd->GetDataFrame()) { }
 
-   std::weak_ptr<TDataFrameImpl> GetDataFrame() const { return fFirstData; }
+/// The functional graph reachable from the booked actions, compiled for a top-down evaluation of blocks of entries.
+/// The filters and ranges form a tree, stored in pre-order: each step knows the step of its parent and where its
+/// subtree ends. For each block, every filter runs once over the entries its parent selected, and the actions
+/// depending on it are executed right after on the entries it selected. No node walks up its chain of filters or
+/// caches results per entry, and nodes are reached through one virtual call per block: the loops over the entries
+/// run in the typed code of each filter and action, where the filter expressions and operations are inlined.
+/// Temporary branches are still evaluated on demand by the nodes that read them.
+class TDataFrameKernel {
+   struct TKernelStep {
+      TDataFrameFilterBase *fFilter;                          ///< nullptr for the root of the graph
+      unsigned int fParent;                                   ///< The step of the parent filter
+      unsigned int fNext;                                     ///< The first step after the subtree of this filter
+      std::vector<Internal::TDataFrameActionBase *> fActions; ///< The actions that depend directly on this filter
+   };
 
-   BranchNames GetTmpBranches() const { return fTmpBranches; }
+   struct TKernelNode {
+      TDataFrameFilterBase *fFilter;
+      std::vector<Internal::TDataFrameActionBase *> fActions;
+      std::vector<unsigned int> fChildren; ///< Indexes of the filters right downstream of this one
+   };
 
-   TDataFrameFilter(const TDataFrameFilter &) = delete;
+   std::vector<TKernelStep> fSteps; ///< The root of the graph, then its filters in pre-order
+   /// The entries of the current block selected by each step, per slot
+   Internal::TSlotStorage<std::vector<Internal::TBlockSelection_t>> fSelections;
 
-   bool CheckFilters(unsigned int slot, int entry)
+   static unsigned int GetNodeIndex(std::vector<TKernelNode> &nodes, TDataFrameFilterBase *filter)
    {
-      if (entry != fLastCheckedEntry[slot]) {
-         if (!fPrevData->CheckFilters(slot, entry)) {
-            // a filter upstream returned false, cache the result
-            fLastResult[slot] = false;
-         } else {
-            // evaluate this filter, cache the result
-            fLastResult[slot] = CheckFilterHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
-         }
-         fLastCheckedEntry[slot] = entry;
-      }
-      return fLastResult[slot];
+      for (unsigned int i = 0; i < nodes.size(); ++i)
+         if (nodes[i].fFilter == filter) return i;
+      // first time this filter is met: attach it, and its ancestors if needed, to the graph
+      const auto parentIdx = GetNodeIndex(nodes, filter->GetParentFilter());
+      nodes.push_back({filter, {}, {}});
+      nodes[parentIdx].fChildren.push_back(nodes.size() - 1);
+      return nodes.size() - 1;
    }
 
-   template <int... S, typename... BranchTypes>
-   bool CheckFilterHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
-                          Internal::TDFTraitsUtils::TStaticSeq<S...>,
-                          unsigned int slot, int entry)
+   void AddSteps(std::vector<TKernelNode> &nodes, unsigned int nodeIdx, unsigned int parentStep)
    {
-      // Take each pointer in tvb, cast it to a pointer to the
-      // correct specialization of TTreeReaderValue, and get its content.
-      // S expands to a sequence of integers 0 to sizeof...(types)-1
-      // S and types are expanded simultaneously by "..."
-      return fFilter(
-         Internal::GetBranchValue<S, BranchTypes>(fReaderValues[slot][S], slot, entry, fBranches[S], fFirstData)...);
+      const unsigned int step = fSteps.size();
+      fSteps.push_back({nodes[nodeIdx].fFilter, parentStep, 0, std::move(nodes[nodeIdx].fActions)});
+      for (auto child : nodes[nodeIdx].fChildren) AddSteps(nodes, child, step);
+      fSteps[step].fNext = fSteps.size();
    }
 
-   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+public:
+   /// Compile the graph of the booked actions
+   void Build(const Internal::ActionBaseVec_t &actions, unsigned int nSlots)
    {
-      fReaderValues[slot] = Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      std::vector<TKernelNode> nodes(1, TKernelNode{nullptr, {}, {}});
+      for (auto &actionPtr : actions)
+         nodes[GetNodeIndex(nodes, actionPtr->GetParentFilter())].fActions.push_back(actionPtr.get());
+      fSteps.clear();
+      AddSteps(nodes, 0, 0);
+      fSelections.Reset(nSlots);
+      for (auto &selections : fSelections) selections.resize(fSteps.size());
    }
 
-   void CreateSlots(unsigned int nSlots)
+   /// Run the graph on a block: `all` lists all the positions of the block
+   void Run(unsigned int slot, const Internal::TEntryBlock &block, const Internal::TBlockSelection_t &all)
    {
-      fReaderValues.resize(nSlots);
-      fLastCheckedEntry.resize(nSlots);
-      fLastResult.resize(nSlots);
+      auto &selections = fSelections[slot];
+      for (unsigned int i = 0; i < fSteps.size();) {
+         const auto &step = fSteps[i];
+         // the root of the graph selects all the entries of the block
+         if (step.fFilter)
+            step.fFilter->EvalBlock(slot, block, step.fParent == 0 ? all : selections[step.fParent], selections[i]);
+         const auto &sel = step.fFilter ? selections[i] : all;
+         if (sel.empty()) {
+            // no entry of the block passes this filter: skip the whole subtree
+            i = step.fNext;
+            continue;
+         }
+         for (auto action : step.fActions) action->ExecuteBlock(slot, block, sel);
+         ++i;
+      }
    }
 };
 
@@ -1339,12 +4952,45 @@ class TDataFrameImpl {
    std::vector<std::shared_ptr<bool>> fResPtrsReadiness;
    std::string fTreeName;
    TDirectory *fDirPtr = nullptr;
+   std::unique_ptr<TChain> fChain; ///< The chain of the input files, if the data frame was built from file names
    TTree *fTree = nullptr;
    const BranchNames fDefaultBranches;
-   // always empty: each object in the chain copies this list from the previous
-   // and they must copy an empty list from the base TDataFrameImpl
+   // each object in the chain copies this list from the previous: it is empty, or it
+   // lists the cached columns, which are read as temporary branches
    const BranchNames fTmpBranches;
    unsigned int fNSlots;
+   bool fReorderFilters = false;
+   bool fIsProfiled = false;
+   Internal::ProfileStorage_t fNextCounters; ///< Calls to TTreeReader::Next, if profiled
+   Internal::ProfileStorage_t fLoadCounters; ///< Loads of the values of real branches, if profiled
+   TDataFrameProfile fProfile;               ///< The profile of the last event loop
+   /// Merges the partial results of the slots of an operation into a result object
+   using PartialMerger_t =
+      std::function<void(const std::vector<unsigned int> &slots, void *partial, Internal::TProgressMonitor &monitor)>;
+   std::map<const void *, PartialMerger_t> fPartialMergers; ///< The mergers of the pending results, by result
+   std::unique_ptr<Internal::TProgressMonitor> fProgress;   ///< Set if progress callbacks are registered
+   Long64_t fTaskSize = 0;                ///< Entries per task in parallel runs, 0 to let the scheduler decide
+   std::vector<std::string> fClusterFileNames;            ///< The files whose clusters are in fClusterBoundaries
+   std::string fClusterTreeName;                          ///< The tree whose clusters are in fClusterBoundaries
+   std::vector<std::vector<Long64_t>> fClusterBoundaries; ///< Cluster boundaries of each input file, for parallel runs
+   std::vector<ULong64_t> fEntriesPerSlot; ///< Entries processed by each slot during the last event loop
+   unsigned int fBatchSize = 0;     ///< Entries per block in batched mode, 0 to process entries one by one
+   unsigned int fLoopBatchSize = 0; ///< The batch size of the current event loop, 0 if entries are processed one by one
+   static constexpr unsigned int fgKernelBatchSize = 1024; ///< Entries per block of kernels, if no batch size is set
+   bool fUseKernel = false;  ///< Whether the graph should be compiled in a kernel, see TDataFrameKernel
+   bool fRunsKernel = false; ///< Whether the current event loop runs the kernel
+   TDataFrameKernel fKernel;
+   /// In batched mode, the readers filling the arrays of the real branches read by the graph, per slot
+   std::vector<std::vector<std::unique_ptr<Internal::TColumnReaderBase>>> fColumnReaders;
+   Internal::TSlotStorage<ULong64_t> fNBlocks;                     ///< Blocks processed by each slot
+   Internal::TSlotStorage<Internal::TBlockSelection_t> fAllPositions; ///< All the positions of the current block
+   unsigned int fNChildren = 0;                  ///< Number of nodes downstream that lead to booked actions
+   std::atomic<unsigned int> fNStopsReceived{0}; ///< Number of nodes downstream that stopped processing entries
+   std::atomic<bool> fStopRequested{false};      ///< Whether the event loop can stop: no action can receive entries
+   std::shared_ptr<TDataFrameImpl> fCacheSource;         ///< Data frame whose first event loop fills the cached columns
+   std::shared_ptr<Internal::TCacheStatus> fCacheStatus; ///< Set if this data frame reads cached columns
+   using LoopGroup_t = std::vector<std::weak_ptr<TDataFrameImpl>>;
+   std::shared_ptr<LoopGroup_t> fLoopGroup; ///< Data frames sharing their event loops with this one, this one included
    // TDataFrameInterface<TDataFrameImpl> calls SetFirstData to set this to a
    // weak pointer to the TDataFrameImpl object itself
    // so subsequent objects in the chain can call GetDataFrame on TDataFrameImpl
@@ -1357,41 +5003,85 @@ public:
    TDataFrameImpl(TTree &tree, const BranchNames &defaultBranches = {}) : fTree(&tree), fDefaultBranches(defaultBranches), fNSlots(ROOT::Internal::GetNSlots())
    { }
 
+   TDataFrameImpl(const std::string &treeName, const std::vector<std::string> &fileNameGlobs,
+                  const BranchNames &defaultBranches = {})
+      : fTreeName(treeName), fChain(new TChain(treeName.c_str())), fDefaultBranches(defaultBranches),
+        fNSlots(ROOT::Internal::GetNSlots())
+   {
+      for (auto &fileNameGlob : fileNameGlobs) fChain->Add(fileNameGlob.c_str());
+      fTree = fChain.get();
+   }
+
+   TDataFrameImpl(const std::shared_ptr<TDataFrameImpl> &cacheSource,
+                  const std::shared_ptr<Internal::TCacheStatus> &cacheStatus,
+                  const std::vector<TmpBranchBasePtr_t> &cachedColumns)
+      : fDefaultBranches(GetNames(cachedColumns)), fTmpBranches(GetNames(cachedColumns)),
+        fNSlots(ROOT::Internal::GetNSlots()), fCacheSource(cacheSource), fCacheStatus(cacheStatus)
+   {
+      for (auto &column : cachedColumns) fBookedBranches[column->GetName()] = column;
+   }
+
    TDataFrameImpl(const TDataFrameImpl &) = delete;
 
-   void Run()
+   static BranchNames GetNames(const std::vector<TmpBranchBasePtr_t> &branches)
+   {
+      BranchNames names;
+      for (auto &branch : branches) names.emplace_back(branch->GetName());
+      return names;
+   }
+
+   // event loop over the entries of the input tree or files
+   void RunOnTree(const std::vector<TDataFrameImpl *> &members)
    {
+      // only the branches read by the booked actions, and by the nodes upstream of them, are read from the input
+      BranchNames readSet;
+      for (auto &member : members)
+         for (auto &actionPtr : member->fBookedActions) actionPtr->AddReadBranches(readSet);
 #ifdef R__USE_IMT
       if (ROOT::IsImplicitMTEnabled()) {
-         const auto fileName = fTree ? static_cast<TFile *>(fTree->GetCurrentFile())->GetName() : fDirPtr->GetName();
-         const std::string    treeName = fTree ? fTree->GetName() : fTreeName;
-         ROOT::TTreeProcessorMT tp(fileName, treeName);
-         ROOT::TSpinMutex     slotMutex;
-         std::map<std::thread::id, unsigned int> slotMap;
-         unsigned int globalSlotIndex = 0;
-         CreateSlots(fNSlots);
-         tp.Process([this, &slotMutex, &globalSlotIndex, &slotMap](TTreeReader &r) -> void {
-            const auto thisThreadID = std::this_thread::get_id();
-            unsigned int slot;
-            {
-               std::lock_guard<ROOT::TSpinMutex> l(slotMutex);
-               auto thisSlotIt = slotMap.find(thisThreadID);
-               if (thisSlotIt != slotMap.end()) {
-                  slot = thisSlotIt->second;
-               } else {
-                  slot = globalSlotIndex;
-                  slotMap[thisThreadID] = slot;
-                  ++globalSlotIndex;
+         // entry ranges of all the input files are distributed among the slots, which steal work from each other
+         const auto fileNames = GetFileNames();
+         const std::string treeName = GetTreeName();
+         // the clusters of the input files are read once, not at every event loop
+         if (fileNames != fClusterFileNames || treeName != fClusterTreeName) {
+            fClusterBoundaries = Internal::TEntryRangeScheduler::GetClusterBoundaries(fileNames, treeName);
+            fClusterFileNames = fileNames;
+            fClusterTreeName = treeName;
+         }
+         Internal::TEntryRangeScheduler scheduler(fClusterBoundaries, fNSlots, fTaskSize);
+         for (auto &member : members) member->CreateSlots(fNSlots);
+         fEntriesPerSlot.assign(fNSlots, 0);
+         // one task per range: a task checks a slot out, processes the ranges of that slot, stealing those of the
+         // other slots once its own are done, and returns the slot. A task that finds all slots taken returns at once.
+         // A slot keeps its input open across tasks, and opens a file only when its next range belongs to another file.
+         struct TSlotInput {
+            std::unique_ptr<TFile> fFile;
+            std::unique_ptr<TTreeReader> fReader;
+            unsigned int fFileIdx = 0;
+         };
+         Internal::TSlotStorage<TSlotInput> inputs(fNSlots);
+         Internal::TSlotPool slotPool(fNSlots);
+         ROOT::TThreadExecutor pool;
+         pool.Foreach([this, &scheduler, &slotPool, &inputs, &fileNames, &treeName, &members, &readSet]() {
+            Internal::TSlotGuard slotGuard(slotPool);
+            if (!slotGuard.HasSlot()) return;
+            const auto slot = slotGuard.GetSlot();
+            auto &input = inputs[slot];
+            Internal::TEntryRange range;
+            // once the event loop can stop, the remaining ranges are dropped
+            while (!IsLoopStopped(members) && scheduler.GetNextRange(slot, range)) {
+               if (!input.fReader || range.fFileIdx != input.fFileIdx) {
+                  input.fFileIdx = range.fFileIdx;
+                  input.fReader.reset();
+                  input.fFile.reset(TFile::Open(fileNames[input.fFileIdx].c_str()));
+                  input.fReader.reset(new TTreeReader(treeName.c_str(), input.fFile.get()));
+                  Internal::SetUpReadSet(*input.fReader->GetTree(), readSet);
+                  for (auto &member : members) member->BuildAllReaderValues(*input.fReader, slot);
                }
+               input.fReader->SetEntriesRange(range.fBegin, range.fEnd);
+               fEntriesPerSlot[slot] += RunEventLoop(*input.fReader, slot, members);
             }
-
-            BuildAllReaderValues(r, slot);
-
-            // recursive call to check filters and conditionally execute actions
-            while (r.Next())
-               for (auto &actionPtr : fBookedActions)
-                  actionPtr->Run(slot, r.GetCurrentEntry());
-         });
+         }, scheduler.GetNRanges());
       } else {
 #endif // R__USE_IMT
          TTreeReader r;
@@ -1401,28 +5091,285 @@ public:
             r.SetTree(fTreeName.c_str(), fDirPtr);
          }
 
-         CreateSlots(1);
-         BuildAllReaderValues(r, 0);
+         // the tree might belong to the user: its branch status and cache are restored after the event loop
+         auto tree = r.GetTree();
+         Internal::TTreeReadState oldState;
+         if (tree) oldState = Internal::SetUpReadSet(*tree, readSet);
 
-         // recursive call to check filters and conditionally execute actions
-         while (r.Next())
-            for (auto &actionPtr : fBookedActions)
-               actionPtr->Run(0, r.GetCurrentEntry());
+         for (auto &member : members) {
+            member->CreateSlots(1);
+            member->BuildAllReaderValues(r, 0);
+         }
+         fEntriesPerSlot.assign(1, RunEventLoop(r, 0, members));
+         if (tree) Internal::RestoreReadState(*tree, oldState);
 #ifdef R__USE_IMT
       }
 #endif // R__USE_IMT
+   }
+
+   // event loop over the cached columns: slots process ranges of entry indexes
+   void RunOnCache()
+   {
+      if (!fCacheStatus->fIsFilled) fCacheSource->Run();
+      fCacheSource.reset(); // the cached columns are filled: the upstream data frame is not needed anymore
+      const ULong64_t nEntries = fCacheStatus->fNEntries;
+      TTreeReader r; // the cached columns are the only branches available: no reader values are built
+#ifdef R__USE_IMT
+      if (ROOT::IsImplicitMTEnabled()) {
+         CreateSlots(fNSlots);
+         for (unsigned int slot = 0; slot < fNSlots; ++slot) BuildAllReaderValues(r, slot);
+         fEntriesPerSlot.assign(fNSlots, 0);
+         const auto rangesPerSlot = Internal::TEntryRangeScheduler::fgRangesPerSlot;
+         const ULong64_t taskSize =
+            fTaskSize > 0 ? fTaskSize : std::max(nEntries / (fNSlots * rangesPerSlot), ULong64_t(1));
+         const unsigned int nTasks = (nEntries + taskSize - 1) / taskSize;
+         // as for the input tree, a task holding a slot processes ranges until there are none left
+         Internal::TSlotPool slotPool(fNSlots);
+         std::atomic<unsigned int> nextRange(0);
+         ROOT::TThreadExecutor pool;
+         pool.Foreach([this, &slotPool, &nextRange, taskSize, nEntries, nTasks](unsigned int) {
+            Internal::TSlotGuard slotGuard(slotPool);
+            if (!slotGuard.HasSlot()) return;
+            const auto slot = slotGuard.GetSlot();
+            // once the event loop can stop, the remaining ranges are dropped
+            for (auto range = nextRange++; range < nTasks && !fStopRequested; range = nextRange++) {
+               const auto begin = range * taskSize;
+               fEntriesPerSlot[slot] += RunEventLoop(begin, std::min(begin + taskSize, nEntries), slot);
+            }
+         }, ROOT::TSeqU(nTasks));
+         return;
+      }
+#endif // R__USE_IMT
+      CreateSlots(1);
+      BuildAllReaderValues(r, 0);
+      fEntriesPerSlot.assign(1, RunEventLoop(0, nEntries, 0));
+   }
+
+   void Run()
+   {
+      // the data frames sharing the event loop with this one, and that have pending actions, run them in the same pass
+      std::vector<std::shared_ptr<TDataFrameImpl>> sharers;
+      if (fLoopGroup) {
+         for (auto &weakDf : *fLoopGroup) {
+            auto df = weakDf.lock();
+            if (df && df.get() != this && !df->fBookedActions.empty()) sharers.emplace_back(df);
+         }
+      }
+      std::vector<TDataFrameImpl *> members({this});
+      for (auto &df : sharers) members.emplace_back(df.get());
+
+      // entries are processed in blocks only if all the booked actions, and the nodes upstream of them, can be
+      // kernels run on blocks of entries
+      unsigned int loopBatchSize = fBatchSize;
+      if (loopBatchSize == 0 && fUseKernel) loopBatchSize = fgKernelBatchSize;
+      for (auto df : members)
+         for (auto &actionPtr : df->fBookedActions)
+            if (!actionPtr->CanProcessBlocks()) loopBatchSize = 0;
+      for (auto df : members) df->fLoopBatchSize = loopBatchSize;
+
+      if (fCacheStatus)
+         RunOnCache();
+      else
+         RunOnTree(members);
+
+      for (auto df : members) {
+         df->fEntriesPerSlot = fEntriesPerSlot;
+         if (df->fIsProfiled) df->fProfile = df->CollectProfile(fNextCounters);
+         // forget actions and "detach" the action result pointers marking them ready and forget them too
+         df->fPartialMergers.clear();
+         df->fProgress.reset();
+         df->fBookedActions.clear();
+         for (auto readiness : df->fResPtrsReadiness) {
+            *readiness.get() = true;
+         }
+         df->fResPtrsReadiness.clear();
+      }
+   }
+
+   /// The time spent in the nodes booked on this data frame, and in the reader, during the last event loop
+   TDataFrameProfile CollectProfile(const Internal::ProfileStorage_t &nextCounters) const
+   {
+      TDataFrameProfile profile;
+      for (auto &ptr : fBookedFilters) ptr->AddProfile(profile);
+      for (auto &bookedBranch : fBookedBranches) bookedBranch.second->AddProfile(profile);
+      for (auto &ptr : fBookedActions) ptr->AddProfile(profile);
+      const auto next = Internal::SumCounters(nextCounters);
+      profile.SetReaderNext(next.fNCalls, next.fTime);
+      const auto load = Internal::SumCounters(fLoadCounters);
+      profile.SetReaderLoad(load.fNCalls, load.fTime);
+      return profile;
+   }
+
+   /// Make the event loops of two data frames on the same input run together. Each one of the
+   /// event loops then executes the pending actions of both data frames, reading the data once.
+   static void ShareEventLoop(const std::shared_ptr<TDataFrameImpl> &df1, const std::shared_ptr<TDataFrameImpl> &df2)
+   {
+      if (df1->fCacheStatus || df2->fCacheStatus || !df1->HasSameInput(*df2)) {
+         throw std::runtime_error("ShareEventLoop: the data frames do not read the same tree from the same files.");
+      }
+      if (!df1->fLoopGroup) df1->fLoopGroup = std::make_shared<LoopGroup_t>(1, df1);
+      if (df2->fLoopGroup == df1->fLoopGroup) return;
+      auto group2 = df2->fLoopGroup ? df2->fLoopGroup : std::make_shared<LoopGroup_t>(1, df2);
+      for (auto &weakDf : *group2) {
+         if (auto df = weakDf.lock()) {
+            df->fLoopGroup = df1->fLoopGroup;
+            df1->fLoopGroup->emplace_back(df);
+         }
+      }
+   }
+
+   bool HasSameInput(const TDataFrameImpl &other) const
+   {
+      if (fTree && fTree == other.fTree) return true;
+      if (GetTreeName() != other.GetTreeName()) return false;
+      try {
+         return GetFileNames() == other.GetFileNames();
+      } catch (const std::runtime_error &) {
+         return false; // trees in memory are only shared by data frames built on the same tree
+      }
+   }
+
+   static bool IsLoopStopped(const std::vector<TDataFrameImpl *> &members)
+   {
+      for (auto &member : members)
+         if (!member->fStopRequested.load(std::memory_order_relaxed)) return false;
+      return true;
+   }
+
+   // loop over the entries of the reader, running the actions of all the data frames sharing the event loop
+   ULong64_t RunEventLoop(TTreeReader &r, unsigned int slot, const std::vector<TDataFrameImpl *> &members)
+   {
+      if (fLoopBatchSize > 0) return RunBlockLoop(r, slot, members);
+      if (members.size() == 1) return RunEventLoop(r, slot);
+      ULong64_t nEntries = 0;
+      for (; !IsLoopStopped(members) && NextEntry(r, slot); ++nEntries) {
+         const auto entry = r.GetCurrentEntry();
+         for (auto &member : members) {
+            if (member->fStopRequested.load(std::memory_order_relaxed)) continue;
+            member->ProcessEntry(slot, entry);
+         }
+      }
+      return nEntries;
+   }
+
+   // loop over the entries of the reader, checking filters and conditionally executing actions
+   ULong64_t RunEventLoop(TTreeReader &r, unsigned int slot)
+   {
+      ULong64_t nEntries = 0;
+      if (fProgress) {
+         for (; !fStopRequested.load(std::memory_order_relaxed) && NextEntry(r, slot); ++nEntries)
+            ProcessEntry(slot, r.GetCurrentEntry());
+      } else {
+         // recursive call to check filters and conditionally execute actions
+         for (; !fStopRequested.load(std::memory_order_relaxed) && NextEntry(r, slot); ++nEntries)
+            for (auto &actionPtr : fBookedActions)
+               actionPtr->Run(slot, r.GetCurrentEntry());
+      }
+      return nEntries;
+   }
+
+   // run the actions on an entry, holding the lock of the slot if progress callbacks read its partial results
+   void ProcessEntry(unsigned int slot, int entry)
+   {
+      {
+         Internal::TProgressMonitor::TSlotLock lock(fProgress.get(), slot);
+         for (auto &actionPtr : fBookedActions) actionPtr->Run(slot, entry);
+      }
+      if (fProgress) fProgress->EntryDone(slot);
+   }
+
+   bool NextEntry(TTreeReader &r, unsigned int slot)
+   {
+      Internal::TProfileTimer timer(Internal::GetSlotCounters(fNextCounters, slot));
+      return r.Next();
+   }
+
+   // loop over the entries of the reader block by block: the values of the real branches are copied entry by
+   // entry in the arrays of the block, then the actions of all the data frames process the whole block
+   ULong64_t RunBlockLoop(TTreeReader &r, unsigned int slot, const std::vector<TDataFrameImpl *> &members)
+   {
+      ULong64_t nEntries = 0;
+      while (!IsLoopStopped(members)) {
+         Long64_t first = 0;
+         unsigned int size = 0;
+         for (; size < fLoopBatchSize && NextEntry(r, slot); ++size) {
+            if (size == 0) first = r.GetCurrentEntry();
+            for (auto &member : members)
+               if (!member->fStopRequested.load(std::memory_order_relaxed)) member->LoadColumns(slot, size);
+         }
+         if (size == 0) break;
+         for (auto &member : members)
+            if (!member->fStopRequested.load(std::memory_order_relaxed)) member->ProcessBlock(slot, first, size);
+         nEntries += size;
+         if (size < fLoopBatchSize) break;
+      }
+      return nEntries;
+   }
+
+   // copy the values of the current entry of the reader at the given position of the arrays of the block
+   void LoadColumns(unsigned int slot, unsigned int pos)
+   {
+      for (auto &reader : fColumnReaders[slot]) {
+         Internal::TProfileTimer timer(Internal::GetSlotCounters(fLoadCounters, slot));
+         reader->Load(pos);
+      }
+   }
+
+   // run the actions on a block of entries, holding the lock of the slot if progress callbacks read its partial
+   // results: the partial results are updated block by block
+   void ProcessBlock(unsigned int slot, Long64_t first, unsigned int size)
+   {
+      const Internal::TEntryBlock block{++fNBlocks[slot], first, size};
+      auto &positions = fAllPositions[slot];
+      if (positions.size() != size) {
+         positions.resize(size);
+         std::iota(positions.begin(), positions.end(), 0u);
+      }
+      {
+         Internal::TProgressMonitor::TSlotLock lock(fProgress.get(), slot);
+         if (fRunsKernel) {
+            fKernel.Run(slot, block, positions);
+         } else {
+            for (auto &actionPtr : fBookedActions) actionPtr->RunBlock(slot, block);
+         }
+      }
+      if (fProgress)
+         for (unsigned int i = 0; i < size; ++i) fProgress->EntryDone(slot);
+   }
+
+   // loop over a range of entries of the cached columns block by block
+   ULong64_t RunBlockLoop(ULong64_t begin, ULong64_t end, unsigned int slot)
+   {
+      auto entry = begin;
+      while (!fStopRequested.load(std::memory_order_relaxed) && entry < end) {
+         const auto size = static_cast<unsigned int>(std::min<ULong64_t>(fLoopBatchSize, end - entry));
+         ProcessBlock(slot, entry, size);
+         entry += size;
+      }
+      return entry - begin;
+   }
 
-      // forget actions and "detach" the action result pointers marking them ready and forget them too
-      fBookedActions.clear();
-      for (auto readiness : fResPtrsReadiness) {
-         *readiness.get() = true;
+   // loop over a range of entries of the cached columns, checking filters and conditionally executing actions
+   ULong64_t RunEventLoop(ULong64_t begin, ULong64_t end, unsigned int slot)
+   {
+      if (fLoopBatchSize > 0) return RunBlockLoop(begin, end, slot);
+      auto entry = begin;
+      if (fProgress) {
+         for (; !fStopRequested.load(std::memory_order_relaxed) && entry < end; ++entry)
+            ProcessEntry(slot, entry);
+      } else {
+         for (; !fStopRequested.load(std::memory_order_relaxed) && entry < end; ++entry)
+            for (auto &actionPtr : fBookedActions)
+               actionPtr->Run(slot, entry);
       }
-      fResPtrsReadiness.clear();
+      return entry - begin;
    }
 
    // build reader values for all actions, filters and branches
    void BuildAllReaderValues(TTreeReader &r, unsigned int slot)
    {
+      // in batched mode the nodes ask for the arrays of the real branches they read: readers are created on demand
+      fColumnReaders[slot].clear();
       for (auto &ptr : fBookedActions) ptr->BuildReaderValues(r, slot);
       for (auto &ptr : fBookedFilters) ptr->BuildReaderValues(r, slot);
       for (auto &bookedBranch : fBookedBranches) bookedBranch.second->BuildReaderValues(r, slot);
@@ -1431,9 +5378,23 @@ public:
    // inform all actions filters and branches of the required number of slots
    void CreateSlots(unsigned int nSlots)
    {
+      fNextCounters.Reset(fIsProfiled ? nSlots : 0);
+      fLoadCounters.Reset(fIsProfiled ? nSlots : 0);
+      if (fProgress) fProgress->Start(nSlots);
+      fColumnReaders.clear();
+      fColumnReaders.resize(nSlots);
+      fNBlocks.Reset(nSlots);
+      fAllPositions.Reset(nSlots);
       for (auto &ptr : fBookedActions) ptr->CreateSlots(nSlots);
       for (auto &ptr : fBookedFilters) ptr->CreateSlots(nSlots);
       for (auto &bookedBranch : fBookedBranches) bookedBranch.second->CreateSlots(nSlots);
+      // count, for every node, the nodes downstream that lead to the booked actions
+      fNChildren = 0;
+      fNStopsReceived = 0;
+      fStopRequested = false;
+      for (auto &ptr : fBookedActions) ptr->TriggerChildrenCount();
+      fRunsKernel = fUseKernel && fLoopBatchSize > 0;
+      if (fRunsKernel) fKernel.Build(fBookedActions, nSlots);
    }
 
    std::weak_ptr<Details::TDataFrameImpl> GetDataFrame() const { return fFirstData; }
@@ -1442,28 +5403,48 @@ public:
 
    const BranchNames GetTmpBranches() const { return fTmpBranches; }
 
+   /// The names of the files the data is read from: all the files of a chain,
+   /// or the file the tree or directory belongs to
+   std::vector<std::string> GetFileNames() const
+   {
+      std::vector<std::string> fileNames;
+      if (!fTree) {
+         fileNames.emplace_back(fDirPtr->GetName());
+      } else if (auto chain = dynamic_cast<TChain *>(fTree)) {
+         for (auto element : *chain->GetListOfFiles()) fileNames.emplace_back(element->GetTitle());
+      } else if (auto file = fTree->GetCurrentFile()) {
+         fileNames.emplace_back(file->GetName());
+      } else {
+         const std::string msg = "Tree \"" + std::string(fTree->GetName()) +
+                                 "\" is not associated to any file: it cannot be processed in parallel";
+         throw std::runtime_error(msg);
+      }
+      return fileNames;
+   }
+
    TTree* GetTree() const {
       if (fTree) {
          return fTree;
+      } else if (!fDirPtr) {
+         return nullptr; // cached columns
       } else {
          auto treePtr = static_cast<TTree*>(fDirPtr->Get(fTreeName.c_str()));
          return treePtr;
       }
    }
 
-   const TDataFrameBranchBase &GetBookedBranch(const std::string &name) const
+   TDataFrameBranchBase &GetBookedBranch(const std::string &name) const
    {
-      return *fBookedBranches.find(name)->second.get();
+      auto it = fBookedBranches.find(name);
+      if (it == fBookedBranches.end()) throw std::runtime_error("unknown branch \"" + name + "\"");
+      return *it->second.get();
    }
 
-   void *GetTmpBranchValue(const std::string &branch, unsigned int slot, int entry)
-   {
-      return fBookedBranches.at(branch)->GetValue(slot, entry);
-   }
+   bool IsCached() const { return fCacheStatus != nullptr; }
 
    TDirectory *GetDirectory() const { return fDirPtr; }
 
-   std::string GetTreeName() const { return fTreeName; }
+   std::string GetTreeName() const { return fTree ? fTree->GetName() : fTreeName; }
 
    void SetFirstData(const std::shared_ptr<TDataFrameImpl>& sp) { fFirstData = sp; }
 
@@ -1476,8 +5457,100 @@ public:
    // dummy call, end of recursive chain of calls
    bool CheckFilters(int, unsigned int) { return true; }
 
+   // all the entries of the block reach the root of the graph
+   const Internal::TBlockSelection_t &CheckBlock(unsigned int slot, const Internal::TEntryBlock &)
+   {
+      return fAllPositions[slot];
+   }
+
+   bool CanProcessBlocks() const { return true; }
+
+   /// The array the values of a real branch are copied in, in batched mode. The nodes reading the same branch
+   /// share its array.
+   template <typename T>
+   T *GetColumnValues(TTreeReader &r, unsigned int slot, const std::string &name)
+   {
+      auto &readers = fColumnReaders[slot];
+      for (auto &reader : readers)
+         if (reader->GetName() == name && reader->GetTypeId() == typeid(T))
+            return static_cast<Internal::TColumnReader<T> *>(reader.get())->GetValues();
+      auto reader = new Internal::TColumnReader<T>(r, name, fLoopBatchSize);
+      readers.emplace_back(reader);
+      return reader->GetValues();
+   }
+
+   // the root of the graph is not a filter
+   TDataFrameFilterBase *GetFilterAncestor() { return nullptr; }
+
+   TDataFrameFilterBase *GetChainedFilter() { return nullptr; }
+
+   void IncrChildrenCount() { ++fNChildren; }
+
+   void AddReadBranches(BranchNames &) const {}
+
+   /// The real branches read by the booked actions and by the nodes upstream of them, each listed once
+   BranchNames GetReadSet() const
+   {
+      BranchNames readSet;
+      for (auto &actionPtr : fBookedActions) actionPtr->AddReadBranches(readSet);
+      return readSet;
+   }
+
+   void StopProcessing()
+   {
+      // no booked action can receive entries anymore
+      if (++fNStopsReceived == fNChildren) fStopRequested = true;
+   }
+
    unsigned int GetNSlots() {return fNSlots;}
 
+   void SetFilterReordering(bool reorder) { fReorderFilters = reorder; }
+
+   bool GetFilterReordering() const { return fReorderFilters; }
+
+   void SetProfiling(bool profile) { fIsProfiled = profile; }
+
+   bool GetProfiling() const { return fIsProfiled; }
+
+   Internal::ProfileStorage_t &GetLoadCounters() { return fLoadCounters; }
+
+   const TDataFrameProfile &GetProfile() const { return fProfile; }
+
+   /// Let the progress callbacks registered on a result read the partial results of the operation computing it
+   template <typename T, typename Op>
+   void SetPartialMerger(T *result, const std::shared_ptr<Op> &op)
+   {
+      fPartialMergers[result] = [op](const std::vector<unsigned int> &slots, void *partial,
+                                     Internal::TProgressMonitor &monitor) {
+         op->MergePartial(slots, *static_cast<T *>(partial), monitor);
+      };
+   }
+
+   const PartialMerger_t &GetPartialMerger(const void *result) const
+   {
+      auto it = fPartialMergers.find(result);
+      if (it == fPartialMergers.end()) {
+         throw std::runtime_error("OnPartialResult: partial results are not available for this action");
+      }
+      return it->second;
+   }
+
+   void AddProgressCallback(ULong64_t everyN, bool perSlot, const Internal::TProgressMonitor::Callback_t &callback)
+   {
+      if (!fProgress) fProgress.reset(new Internal::TProgressMonitor());
+      fProgress->Add(everyN, perSlot, callback);
+   }
+
+   void SetTaskSize(Long64_t taskSize) { fTaskSize = taskSize; }
+
+   void SetBatchSize(unsigned int batchSize) { fBatchSize = batchSize; }
+
+   void SetKernelMode(bool useKernel) { fUseKernel = useKernel; }
+
+   unsigned int GetLoopBatchSize() const { return fLoopBatchSize; }
+
+   const std::vector<ULong64_t> &GetEntriesPerSlot() const { return fEntriesPerSlot; }
+
    template<typename T>
    TActionResultProxy<T> MakeActionResultPtr(std::shared_ptr<T> r)
    {
@@ -1511,6 +5584,33 @@ TDataFrameInterface<T>::TDataFrameInterface(TTree &tree, const BranchNames &defa
    fProxiedPtr->SetFirstData(fProxiedPtr);
 }
 
+template <typename T>
+TDataFrameInterface<T>::TDataFrameInterface(const std::string &treeName, const std::string &fileNameGlob,
+                                            const BranchNames &defaultBranches)
+   : TDataFrameInterface(treeName, std::vector<std::string>{fileNameGlob}, defaultBranches)
+{
+}
+
+template <typename T>
+TDataFrameInterface<T>::TDataFrameInterface(const std::string &treeName, const std::vector<std::string> &fileNameGlobs,
+                                            const BranchNames &defaultBranches)
+   : fProxiedPtr(std::make_shared<Details::TDataFrameImpl>(treeName, fileNameGlobs, defaultBranches))
+{
+   fProxiedPtr->SetFirstData(fProxiedPtr);
+}
+
+template <typename Proxied>
+template <typename T>
+void TDataFrameInterface<Proxied>::ShareEventLoop(TDataFrameInterface<T> &other)
+{
+   Details::TDataFrameImpl::ShareEventLoop(GetDataFrameChecked(), other.GetDataFrameChecked());
+}
+
+inline Internal::Operations::ReportOperation::~ReportOperation()
+{
+   for (auto filter : fFilters) filter->FillReport(*fReport);
+}
+
 template<typename T>
 void TActionResultProxy<T>::TriggerRun()
 {
@@ -1521,21 +5621,81 @@ void TActionResultProxy<T>::TriggerRun()
    df->Run();
 }
 
+/// The callback is called by the worker threads while the event loop runs, and must be thread-safe.
+/// If `perSlot` is false, it is called every `everyNEntries` entries processed by all slots together,
+/// with the partial results of all slots merged; a call due while the previous one is still running is
+/// skipped. If `perSlot` is true, each slot calls it every `everyNEntries` entries it processes, with
+/// its own partial result. To merge the partial results of a slot, the callback waits for the slot to
+/// finish its current entry; it never waits for all slots at once. Partial results are available for
+/// Count, Histo, Histo2D, Histo3D, Profile1D, Profile2D, Min, Max, Mean, Stats, Quantiles, Reduce and
+/// Aggregate. Must be called before the event loop runs.
+template <typename T>
+void TActionResultProxy<T>::OnPartialResult(ULong64_t everyNEntries,
+                                            const std::function<void(const T &, const TLoopProgress &)> &callback,
+                                            bool perSlot)
+{
+   auto df = fFirstData.lock();
+   if (!df) {
+      throw std::runtime_error("The main TDataFrame is not reachable: did it go out of scope?");
+   }
+   if (*fReadiness) throw std::runtime_error("OnPartialResult: the event loop already ran");
+   if (everyNEntries == 0) throw std::runtime_error("OnPartialResult: the number of entries must be positive");
+   auto merger = df->GetPartialMerger(fObjPtr.get());
+   df->AddProgressCallback(everyNEntries, perSlot, [merger, callback](Internal::TProgressMonitor &monitor,
+                                                                      const std::vector<unsigned int> &slots,
+                                                                      const TLoopProgress &progress) {
+      T partial;
+      merger(slots, &partial, monitor);
+      callback(partial, progress);
+   });
+}
+
 namespace Internal {
+Details::TDataFrameBranchBase *GetTmpBranchPtr(Details::TDataFrameImpl &df, const std::string &branch,
+                                               const BranchNames &tmpbl, const std::type_info &type)
+{
+   if (std::find(tmpbl.begin(), tmpbl.end(), branch) == tmpbl.end()) {
+      if (df.IsCached()) throw std::runtime_error("branch \"" + branch + "\" is not among the cached columns");
+      return nullptr; // real branch
+   }
+
+   auto &tmpBranch = df.GetBookedBranch(branch);
+   if (tmpBranch.GetTypeId() != type) {
+      auto msg = "the type of temporary branch \"" + branch +
+                 "\" does not match the type requested by a filter, temporary branch or action";
+      throw std::runtime_error(msg);
+   }
+   return &tmpBranch;
+}
+
 template <int S, typename T>
-T &GetBranchValue(TVBPtr_t &readerValue, unsigned int slot, int entry, const std::string &branch,
-                  std::weak_ptr<Details::TDataFrameImpl> df)
+T &GetBranchValue(TVBPtr_t &readerValue, Details::TDataFrameBranchBase *tmpBranch, unsigned int slot, int entry,
+                  TProfileCounters *loadCounters)
 {
-   if (readerValue == nullptr) {
+   if (tmpBranch != nullptr) {
       // temporary branch
-      void *tmpBranchVal = df.lock()->GetTmpBranchValue(branch, slot, entry);
-      return *static_cast<T *>(tmpBranchVal);
+      return *static_cast<T *>(tmpBranch->GetValue(slot, entry));
    } else {
-      // real branch
-      return **std::static_pointer_cast<TTreeReaderValue<T>>(readerValue);
+      // real branch: the value is loaded from the tree when first dereferenced in an entry
+      TProfileTimer timer(loadCounters);
+      return TBranchReader<T>::GetValue(readerValue.get());
    }
 }
 
+template <typename T>
+T *GetColumnValues(Details::TDataFrameImpl &df, TTreeReader &r, unsigned int slot, const std::string &branch)
+{
+   return df.GetColumnValues<T>(r, slot, branch);
+}
+
+template <typename T>
+T *GetBlockValues(void *column, Details::TDataFrameBranchBase *tmpBranch, unsigned int slot, const TEntryBlock &block,
+                  const TBlockSelection_t &sel)
+{
+   if (tmpBranch != nullptr) return static_cast<T *>(tmpBranch->GetBlockValues(slot, block, sel));
+   return static_cast<T *>(column);
+}
+
 } // end NS Internal
 
 } // end NS ROOT
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <cmath>
 #include "../TDataFrame.hxx"
 #include "TFile.h"
 #include "TMath.h"
@@ -14,6 +17,8 @@
 
 const char* fileName = "myBigfile.root";
 const char* treeName = "myTree";
+const char* scalingFileName = "myScalingFile.root";
+const char* scalingTreeName = "myScalingTree";
 const unsigned int nevts = 100000;
 const unsigned int poolSize = 4;
 
@@ -91,6 +96,21 @@ void FillTree(const char* filename, const char* treeName) {
    return;
 }
 
+// A tree with many clusters, so that its entries can be processed by many threads at once
+void FillScalingTree(const char* filename, const char* treeName) {
+   if (!gSystem->AccessPathName(filename)) return;
+   TFile f(filename,"RECREATE");
+   TTree t(treeName,treeName);
+   double x;
+   t.Branch("x", &x);
+   t.SetAutoFlush(1000);
+   for(int i = 0; i < 256000; ++i) {
+      x = i;
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
 
 void RunTDataFrame(TFile& f){
 
@@ -128,6 +148,121 @@ void LoopRunTDataFrame(int n, TFile& f) {
    }
 }
 
+// a deep chain of cheap temporary branches: the cost is dominated by the
+// access to the values of upstream temporary branches
+void RunTDataFrameDeepChain(TFile& f){
+   ROOT::TDataFrame d(treeName, &f, {"b1"});
+   auto dd = d.AddBranch("b1_1", [](double b1) { return b1 + 1; })
+              .AddBranch("b1_2", [](double b1_1) { return b1_1 + 1; }, {"b1_1"})
+              .AddBranch("b1_3", [](double b1_2) { return b1_2 + 1; }, {"b1_2"})
+              .AddBranch("b1_4", [](double b1_3) { return b1_3 + 1; }, {"b1_3"})
+              .AddBranch("b1_5", [](double b1_4, double b1_1) { return b1_4 + b1_1; }, {"b1_4", "b1_1"})
+              .Filter([](double b1_5, double b1_3) { return b1_5 > b1_3; }, {"b1_5", "b1_3"});
+   auto m = dd.Mean("b1_5");
+   *m;
+}
+
+void LoopRunTDataFrameDeepChain(int n, TFile& f) {
+   for (int i = 0 ; i< n; ++i) {
+      RunTDataFrameDeepChain(f);
+   }
+}
+
+// a graph with shared filters and several actions hanging from each of them
+void RunTDataFrameForked(TFile& f, bool useKernel){
+   ROOT::TDataFrame d(treeName, &f, {"b1"});
+   d.SetKernelMode(useKernel);
+   auto f1 = d.Filter([](double b1) { return b1 > 10; });
+   auto f2 = f1.Filter([](int b2) { return b2 % 2 == 0; }, {"b2"});
+   auto f3 = f1.Filter([](int b2) { return b2 % 3 == 0; }, {"b2"});
+   auto c1 = f1.Count();
+   auto m1 = f1.Mean("b1");
+   auto c2 = f2.Count();
+   auto m2 = f2.Max("b1");
+   auto c3 = f3.Count();
+   auto m3 = f3.Min("b1");
+   *c1;
+}
+
+void LoopRunTDataFrameForked(int n, TFile& f, bool useKernel) {
+   for (int i = 0 ; i< n; ++i) {
+      RunTDataFrameForked(f, useKernel);
+   }
+}
+
+// a cheap selection, a temporary branch and actions with batch entry points: compares the
+// processing of entries one by one with the processing of blocks of entries
+void RunTDataFrameBatched(TFile& f, unsigned int batchSize){
+   ROOT::TDataFrame d(treeName, &f, {"b1"});
+   d.SetBatchSize(batchSize);
+   auto fd = d.Filter([](double b1) { return b1 > 10; }).AddBranch("b1sq", [](double b1) { return b1 * b1; });
+   auto h = fd.Histo("b1", 128, 0., nevts);
+   auto mi = fd.Min("b1sq");
+   auto ma = fd.Max("b1sq");
+   auto me = fd.Mean("b1sq");
+   *h;
+}
+
+void LoopRunTDataFrameBatched(int n, TFile& f, unsigned int batchSize) {
+   for (int i = 0 ; i< n; ++i) {
+      RunTDataFrameBatched(f, batchSize);
+   }
+}
+
+// write two real branches and a temporary one to a new file
+void RunTDataFrameSnapshot(TFile& f){
+   ROOT::TDataFrame d(treeName, &f, {"tracks"});
+   d.AddBranch("tracks_n", [](const FourVectors& tracks){return (int)tracks.size();})
+    .Snapshot<double, int, int>(treeName, "mySnapshotFile.root", {"b1", "b2", "tracks_n"});
+}
+
+void LoopRunTDataFrameSnapshot(int n, TFile& f) {
+   for (int i = 0 ; i< n; ++i) {
+      RunTDataFrameSnapshot(f);
+   }
+}
+
+// a filter with some work per entry, so that the event loop is not dominated by reading:
+// returns the elapsed time, to compare runs with and without implicit multi-threading
+double RunTDataFrameCountMean(TFile& f) {
+   ROOT::TDataFrame d(scalingTreeName, &f, {"x"});
+   auto work = [](double x) {
+      double s = 0.;
+      for (int i = 0; i < 200; ++i) s += std::sin(x + i);
+      return s < 1e9;
+   };
+   auto fd = d.Filter(work);
+   auto count = fd.Count();
+   auto mean = fd.Mean();
+   const auto start = std::chrono::high_resolution_clock::now();
+   *count;
+   const std::chrono::duration<double> deltaT = std::chrono::high_resolution_clock::now() - start;
+   return deltaT.count();
+}
+
+// multi-dimensional histograms and profiles filled with temporary branches, one of which takes some work:
+// returns the elapsed time, to compare runs with and without implicit multi-threading
+double RunTDataFrameFill(TFile& f) {
+   ROOT::TDataFrame d(scalingTreeName, &f, {"x"});
+   auto getY = [](double x) {
+      double s = 0.;
+      for (int i = 0; i < 200; ++i) s += std::sin(x + i);
+      return s;
+   };
+   auto dd = d.AddBranch("y", getY)
+              .AddBranch("z", [](double x) { return std::fmod(x, 100.); })
+              .AddBranch("w", [](double x) { return x < 128000 ? 1. : 2.; });
+   auto h2 = dd.Histo2D("x", "y", TH2F("h2", "h2", 64, 0., 256000., 20, -10., 10.));
+   auto h2w = dd.Histo2D("x", "z", "w", TH2F("h2w", "h2w", 64, 0., 256000., 10, 0., 100.));
+   auto h3 = dd.Histo3D("x", "y", "z", TH3F("h3", "h3", 8, 0., 256000., 8, -10., 10., 8, 0., 100.));
+   auto p1 = dd.Profile1D("z", "x", TProfile("p1", "p1", 10, 0., 100.));
+   auto p2 = dd.Profile2D("x", "z", "y", "w", TProfile2D("p2", "p2", 8, 0., 256000., 10, 0., 100.));
+   const auto start = std::chrono::high_resolution_clock::now();
+   *h2;
+   const std::chrono::duration<double> deltaT = std::chrono::high_resolution_clock::now() - start;
+   return deltaT.count();
+}
+
 void RunTTreeDraw(TFile& f) {
    auto tree = (TTree*) f.Get(treeName);
    tree->Draw("tracks.Pt() >> tPt", "@tracks > 2");
@@ -145,8 +280,10 @@ void LoopRunTTreeDraw(int n, TFile& f) {
 int main(){
 
    FillTree(fileName, treeName);
+   FillScalingTree(scalingFileName, scalingTreeName);
 
    TFile f(fileName);
+   TFile sf(scalingFileName);
 
    auto getPt = [](const FourVectors& tracks) {
    std::vector<double> pts;
@@ -177,6 +314,60 @@ int main(){
       std::cout << "TDataFrame measurement with " << measurementloops << " loops.";
    }
 
+   // TDataFrame deep chain of temporary branches ------------------------------
+   LoopRunTDataFrameDeepChain(warmuploops, f);
+
+   // measure
+   {
+      TimerRAII tr;
+      LoopRunTDataFrameDeepChain(measurementloops, f);
+      std::cout << "TDataFrame deep chain measurement with " << measurementloops << " loops.";
+   }
+
+   // TDataFrame forked graph, default dispatch vs kernel mode -----------------
+   for (auto useKernel : {false, true}) {
+      LoopRunTDataFrameForked(warmuploops, f, useKernel);
+
+      // measure
+      {
+         TimerRAII tr;
+         LoopRunTDataFrameForked(measurementloops, f, useKernel);
+         std::cout << "TDataFrame forked graph measurement " << (useKernel ? "in kernel mode" : "with default dispatch")
+                   << " with " << measurementloops << " loops.";
+      }
+   }
+
+   // TDataFrame actions processing entries one by one and in blocks ---------
+   for (auto batchSize : {0u, 1024u}) {
+      LoopRunTDataFrameBatched(warmuploops, f, batchSize);
+
+      // measure
+      {
+         TimerRAII tr;
+         LoopRunTDataFrameBatched(measurementloops, f, batchSize);
+         std::cout << "TDataFrame actions with a batch size of " << batchSize << " measurement with "
+                   << measurementloops << " loops.";
+      }
+   }
+
+   // TDataFrame Snapshot -----------------------------------------------------
+   LoopRunTDataFrameSnapshot(warmuploops, f);
+
+   // measure
+   {
+      TimerRAII tr;
+      LoopRunTDataFrameSnapshot(measurementloops, f);
+      std::cout << "TDataFrame snapshot of " << nevts << " entries measurement with " << measurementloops << " loops.";
+   }
+
+   // TDataFrame Count and Mean, sequential time for the scaling measurement ---
+   RunTDataFrameCountMean(sf);
+   const auto countMeanSeqTime = RunTDataFrameCountMean(sf);
+
+   // TDataFrame Histo2D, Histo3D, Profile1D and Profile2D, sequential time for the scaling measurement
+   RunTDataFrameFill(sf);
+   const auto fillSeqTime = RunTDataFrameFill(sf);
+
    // TDataFrame Draw // -------------------------------------------------------
    ROOT::EnableImplicitMT(poolSize);
    LoopRunTDataFrame(warmuploops, f);
@@ -188,5 +379,29 @@ int main(){
       std::cout << "TDataFrame measurement with a pool size of " << poolSize << " with " << measurementloops << " loops.";
    }
 
+   // TDataFrame Count and Mean // -----------------------------------------------
+   // with threads that do not share the cache lines they write to, the speedup should be close to the ideal one
+   RunTDataFrameCountMean(sf);
+   const auto nThreads = std::min(poolSize, std::max(1u, std::thread::hardware_concurrency()));
+   std::cout << "\nSpeedup of Count and Mean with a pool size of " << poolSize << ": "
+             << countMeanSeqTime / RunTDataFrameCountMean(sf) << " (ideal: " << nThreads << ")\n";
+
+   // TDataFrame Histo2D, Histo3D, Profile1D and Profile2D // ------------------
+   // every slot fills its own copy of each histogram: the speedup should be close to the ideal one
+   RunTDataFrameFill(sf);
+   std::cout << "Speedup of Histo2D, Histo3D, Profile1D and Profile2D with a pool size of " << poolSize << ": "
+             << fillSeqTime / RunTDataFrameFill(sf) << " (ideal: " << nThreads << ")\n";
+
+   // TDataFrame Snapshot // ---------------------------------------------------
+   LoopRunTDataFrameSnapshot(warmuploops, f);
+
+   // measure
+   {
+      TimerRAII tr;
+      LoopRunTDataFrameSnapshot(measurementloops, f);
+      std::cout << "TDataFrame snapshot of " << nevts << " entries measurement with a pool size of " << poolSize
+                << " with " << measurementloops << " loops.";
+   }
+
 
 }
@@ -13,7 +13,7 @@ popd > /dev/null
 echo "checking executables..."
 FILES=(test_misc testIMT tdf001_introduction tdf002_dataModel regression_multipletriggerrun \
        test_functiontraits regression_zeroentries test_branchoverwrite test_foreach \
-       regression_invalidref)
+       regression_invalidref test_allocations)
 RETCODE=0
 for F in ${FILES[@]}; do
    ../tests/$F | diff $F.out -
@@ -1,14 +1,21 @@
 #include "Math/Vector3D.h"
 #include "Math/Vector4D.h"
 #include "../TDataFrame.hxx"
+#include "TChain.h"
 #include "TFile.h"
 #include "TMath.h"
 #include "TTree.h"
 #include "TRandom3.h"
 #include "TSystem.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <numeric>
 #include <chrono>
+#include <string>
+#include <thread>
 
 // A simple class to measure time.
 class TimerRAII{
@@ -85,6 +92,64 @@ void FillTree(const char* filename, const char* treeName) {
 auto fileName = "myBigfile.root";
 auto treeName = "myTree";
 
+// A tree with many clusters, so that its entries can be processed by many threads at once
+void FillScalingTree(const char* filename, const char* treeName) {
+   if (!gSystem->AccessPathName(filename)) return;
+   TFile f(filename,"RECREATE");
+   TTree t(treeName,treeName);
+   double x;
+   t.Branch("x", &x);
+   t.SetAutoFlush(1000);
+   for(int i = 0; i < 64000; ++i) {
+      x = i;
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+auto scalingFileName = "myScalingFile.root";
+auto scalingTreeName = "myScalingTree";
+
+// A dataset split in several files, each with several clusters
+const unsigned int nChainFiles = 8;
+auto chainTreeName = "myChainTree";
+
+std::string GetChainFileName(unsigned int i) {
+   return "myChainFile_" + std::to_string(i) + ".root";
+}
+
+void FillChainFiles() {
+   for (unsigned int i = 0; i < nChainFiles; ++i) {
+      const auto filename = GetChainFileName(i);
+      if (!gSystem->AccessPathName(filename.c_str())) continue;
+      TFile f(filename.c_str(),"RECREATE");
+      TTree t(chainTreeName,chainTreeName);
+      double x;
+      t.Branch("x", &x);
+      t.SetAutoFlush(1000);
+      for(int j = 0; j < 4000; ++j) {
+         x = i * 4000 + j;
+         t.Fill();
+      }
+      t.Write();
+      f.Close();
+   }
+}
+
+// Whether the rank of each approximate quantile is within accuracy * N of the requested one
+bool AreQuantilesAccurate(std::vector<double> values, const std::vector<double> &quantiles,
+                          const std::vector<double> &qs, double accuracy) {
+   std::sort(values.begin(), values.end());
+   const double n = values.size();
+   for (unsigned int i = 0; i < qs.size(); ++i) {
+      const double lowRank = std::lower_bound(values.begin(), values.end(), quantiles[i]) - values.begin();
+      const double highRank = std::upper_bound(values.begin(), values.end(), quantiles[i]) - values.begin();
+      if (qs[i] * n < lowRank - accuracy * n || qs[i] * n > highRank + accuracy * n) return false;
+   }
+   return true;
+}
+
 void tests(int argc = 1, char** argv = nullptr) {
 
    TFile f(fileName);
@@ -195,12 +260,190 @@ void tests(int argc = 1, char** argv = nullptr) {
       std::cout << "Get: size of list<double> " << double_list->size() << std::endl;
    }
 
+   std::cout << "\nGetting a column as chunks, and concatenating collections" << std::endl;
+   {
+      ROOT::TDataFrame d(treeName, &f);
+      auto chunks = d.Take<double, ROOT::TChunkedVector<double>>("b1");
+      auto values = d.Take<double, std::vector<double>>("b1");
+      auto pairs = d.AddBranch("b1_pair", [](double b1) { return std::vector<double>{b1, -b1}; }, {"b1"})
+                    .Take<std::vector<double>, std::vector<double>>("b1_pair");
+      auto flat = chunks->Flatten();
+      std::sort(flat.begin(), flat.end());
+      std::vector<double> sortedValues(values->begin(), values->end());
+      std::sort(sortedValues.begin(), sortedValues.end());
+      std::cout << "Take: size of chunked vector " << chunks->size() << ", sum of its values "
+                << std::accumulate(chunks->begin(), chunks->end(), 0.) << std::endl;
+      std::cout << "Flattened chunks hold the values of the column: " << std::boolalpha << (flat == sortedValues)
+                << std::noboolalpha << std::endl;
+      std::cout << "Concatenated collections: size " << pairs->size() << ", sum of the values "
+                << std::accumulate(pairs->begin(), pairs->end(), 0.) << std::endl;
+   }
+
+   std::cout << "\nQuantiles of a column and of a collection" << std::endl;
+   {
+      ROOT::TDataFrame d(treeName, &f);
+      auto dd = d.AddBranch("tracks_pts", [](const FourVectors& tracks) {
+         std::vector<double> pts;
+         for (auto& t:tracks) pts.emplace_back(t.Pt());
+         return pts;
+      }, {"tracks"});
+      const std::vector<double> qs = {0., 0.1, 0.5, 0.9, 0.99, 1.};
+      const double accuracy = 0.01;
+      auto b1Quantiles = d.Quantiles("b1", qs, accuracy);
+      auto ptQuantiles = dd.Quantiles("tracks_pts", qs, accuracy);
+      auto b1Values = d.Take<double, std::vector<double>>("b1");
+      auto ptValues = dd.Aggregate([]() { return std::vector<double>(); },
+                                   [](std::vector<double> &acc, const std::vector<double> &pts) {
+                                      acc.insert(acc.end(), pts.begin(), pts.end());
+                                   },
+                                   [](std::vector<double> &acc, const std::vector<double> &other) {
+                                      acc.insert(acc.end(), other.begin(), other.end());
+                                   },
+                                   "tracks_pts");
+      std::cout << "Minimum and maximum of b1 " << b1Quantiles->front() << " " << b1Quantiles->back() << std::endl;
+      std::cout << "Quantiles of b1 are within the accuracy: " << std::boolalpha
+                << AreQuantilesAccurate(*b1Values, *b1Quantiles, qs, accuracy) << std::endl;
+      std::cout << "Quantiles of track Pts are within the accuracy: " << std::boolalpha
+                << AreQuantilesAccurate(*ptValues, *ptQuantiles, qs, accuracy) << std::noboolalpha << std::endl;
+   }
+
+   std::cout << "\nCount and Mean of a tree with many clusters" << std::endl;
+   {
+      TFile sf(scalingFileName);
+      ROOT::TDataFrame d(scalingTreeName, &sf);
+
+      // some work per entry, so that the event loop is not dominated by reading
+      auto work = [](double x) {
+         double s = 0.;
+         for (int i = 0; i < 200; ++i) s += std::sin(x + i);
+         return s < 1e9;
+      };
+      auto fd = d.Filter(work, {"x"});
+      auto count = fd.Count();
+      auto mean = fd.Mean("x");
+      std::cout << "Count " << *count << " mean " << *mean << std::endl;
+   }
+
+   std::cout << "\nHisto2D, Histo3D, Profile1D and Profile2D of a tree with many clusters" << std::endl;
+   {
+      TFile sf(scalingFileName);
+      ROOT::TDataFrame d(scalingTreeName, &sf);
+
+      // some work per entry, so that the event loop is not dominated by filling
+      auto getY = [](double x) {
+         double s = 0.;
+         for (int i = 0; i < 200; ++i) s += std::sin(x + i);
+         return s;
+      };
+      auto dd = d.AddBranch("y", getY, {"x"})
+                 .AddBranch("z", [](double x) { return std::fmod(x, 100.); }, {"x"})
+                 .AddBranch("w", [](double x) { return x < 32000 ? 1. : 2.; }, {"x"});
+      auto h2 = dd.Histo2D("x", "y", TH2F("h2", "h2", 64, 0., 64000., 20, -10., 10.));
+      auto h2w = dd.Histo2D("x", "z", "w", TH2F("h2w", "h2w", 64, 0., 64000., 10, 0., 100.));
+      auto h3 = dd.Histo3D("x", "y", "z", TH3F("h3", "h3", 8, 0., 64000., 8, -10., 10., 8, 0., 100.));
+      auto p1 = dd.Profile1D("z", "x", TProfile("p1", "p1", 10, 0., 100.));
+      auto p2 = dd.Profile2D("x", "z", "y", "w", TProfile2D("p2", "p2", 8, 0., 64000., 10, 0., 100.));
+      std::cout << "Histo2D entries and mean " << h2->GetEntries() << " " << h2->GetMean() << std::endl;
+      std::cout << "Weighted Histo2D entries and mean " << h2w->GetEntries() << " " << h2w->GetMean() << std::endl;
+      std::cout << "Histo3D entries and mean " << h3->GetEntries() << " " << h3->GetMean() << std::endl;
+      std::cout << "Profile1D entries and mean " << p1->GetEntries() << " " << p1->GetMean() << std::endl;
+      std::cout << "Profile2D entries and mean " << p2->GetEntries() << " " << p2->GetMean() << std::endl;
+   }
+
+   std::cout << "\nHisto2D and Profile1D of collections" << std::endl;
+   {
+      auto getPts = [](const FourVectors &tracks) {
+         std::vector<double> pts;
+         for (auto &t : tracks) pts.emplace_back(t.Pt());
+         return pts;
+      };
+      auto getEtas = [](const FourVectors &tracks) {
+         std::vector<double> etas;
+         for (auto &t : tracks) etas.emplace_back(t.Eta());
+         return etas;
+      };
+      ROOT::TDataFrame d(treeName, &f, {"tracks"});
+      auto ad = d.AddBranch("tracks_pts", getPts).AddBranch("tracks_etas", getEtas);
+      auto h = ad.Histo2D<std::vector<double>, std::vector<double>>(
+         "tracks_pts", "tracks_etas", TH2F("ptEta", "ptEta", 64, 0., 64., 30, -3., 3.));
+      auto p = ad.Profile1D<std::vector<double>, std::vector<double>, double>(
+         "tracks_etas", "tracks_pts", "b1", TProfile("ptVsEta", "ptVsEta", 30, -3., 3.));
+      auto hPts = ad.Histo("tracks_pts", 64, 0., 64.);
+      // one point per track
+      std::cout << "Histo2D of collections has an entry per track: " << std::boolalpha
+                << (h->GetEntries() == hPts->GetEntries()) << std::endl;
+      std::cout << "Weighted Profile1D of collections has an entry per track: "
+                << (p->GetEntries() == hPts->GetEntries()) << std::noboolalpha << std::endl;
+   }
+
+   std::cout << "\nProcessing a growing number of files" << std::endl;
+   for (unsigned int nFiles = 1; nFiles <= nChainFiles; nFiles *= 2) {
+      std::vector<std::string> fileNames;
+      for (unsigned int i = 0; i < nFiles; ++i)
+         fileNames.emplace_back(GetChainFileName(i));
+      ROOT::TDataFrame d(chainTreeName, fileNames);
+      auto count = d.Count();
+      auto mean = d.Mean("x");
+      std::cout << nFiles << " files: count " << *count << " mean " << *mean << std::endl;
+   }
+
+   std::cout << "\nProcessing files matching a pattern" << std::endl;
+   {
+      ROOT::TDataFrame d(chainTreeName, "myChainFile_*.root");
+      auto count = d.Count();
+      std::cout << "Count " << *count << std::endl;
+   }
+
+   std::cout << "\nProcessing tasks smaller than clusters" << std::endl;
+   {
+      ROOT::TDataFrame d(treeName, &f);
+      d.SetTaskSize(100);
+      // a few entries are much more expensive than the others
+      auto skewed = [](double b1) {
+         if (int(b1) % 4000 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+         return true;
+      };
+      auto count = d.Filter(skewed, {"b1"}).Count();
+      *count;
+      const auto entriesPerSlot = d.GetEntriesPerSlot();
+      std::cout << "Count " << *count << ", sum of the entries processed by each slot "
+                << std::accumulate(entriesPerSlot.begin(), entriesPerSlot.end(), 0ull) << std::endl;
+   }
+
+   std::cout << "\nNested parallelism in a filter" << std::endl;
+   {
+      ROOT::TDataFrame d(treeName, &f);
+      d.SetTaskSize(100);
+      // workers waiting for the parallel work of the filter may run other tasks of the event loop
+      auto nested = [](double b1) {
+         if (int(b1) % 16 != 0) return true;
+         std::atomic<unsigned int> nCalls(0);
+         ROOT::TThreadExecutor pool;
+         pool.Foreach([&nCalls]() { ++nCalls; }, 8);
+         return nCalls == 8;
+      };
+      auto count = d.Filter(nested, {"b1"}).Count();
+      std::cout << "Count " << *count << std::endl;
+   }
+
+   std::cout << "\nProcessing a TChain" << std::endl;
+   {
+      TChain chain(chainTreeName);
+      for (unsigned int i = 0; i < nChainFiles; ++i)
+         chain.Add(GetChainFileName(i).c_str());
+      ROOT::TDataFrame d(chain);
+      auto max = d.Max("x");
+      std::cout << "Max " << *max << std::endl;
+   }
+
 }
 
 int main(int argc, char** argv) {
 
    // Prepare an input tree to run on
    FillTree(fileName,treeName);
+   FillScalingTree(scalingFileName, scalingTreeName);
+   FillChainFiles();
 
    std::cout << "Running sequentially." << std::endl;
    {
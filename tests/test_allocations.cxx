@@ -0,0 +1,79 @@
+#include "TFile.h"
+#include "TTree.h"
+#include "TDataFrame.hxx"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// count all heap allocations performed by the program
+std::atomic<unsigned long> gNAllocs(0);
+
+void *operator new(std::size_t size)
+{
+   ++gNAllocs;
+   if (void *p = std::malloc(size)) return p;
+   throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+   std::free(p);
+}
+
+void FillTree(const char *filename, const char *treeName, int nEntries)
+{
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   double b1;
+   t.Branch("b1", &b1);
+   for (int i = 0; i < nEntries; ++i) {
+      b1 = i;
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+// return the number of allocations performed by an event loop over a chain of temporary branches
+unsigned long CountAllocsInLoop(const char *filename, const char *treeName)
+{
+   TFile f(filename);
+   ROOT::TDataFrame d(treeName, &f, {"b1"});
+   auto dd = d.AddBranch("b2", [](double b1) { return b1 * 2; })
+              .AddBranch("b4", [](double b2) { return b2 * 2; }, {"b2"})
+              .AddBranch("b8", [](double b4) { return b4 * 2; }, {"b4"})
+              .Filter([](double b8) { return b8 > 0; }, {"b8"})
+              .AddBranch("b16", [](double b8, double b4) { return b8 + b4 + b4; }, {"b8", "b4"});
+   auto c = dd.Count();
+   auto m = dd.Mean("b16");
+   const auto nAllocsBefore = gNAllocs.load();
+   *c; // triggers the event loop
+   const auto nAllocs = gNAllocs.load() - nAllocsBefore;
+   std::cout << "count " << *c << " mean " << *m << std::endl;
+   return nAllocs;
+}
+
+int main()
+{
+   const auto treeName = "allocTree";
+   const int nSmall = 10;
+   const int nLarge = 100000;
+   FillTree("allocTreeSmall.root", treeName, nSmall);
+   FillTree("allocTreeLarge.root", treeName, nLarge);
+
+   const auto allocsSmall = CountAllocsInLoop("allocTreeSmall.root", treeName);
+   const auto allocsLarge = CountAllocsInLoop("allocTreeLarge.root", treeName);
+
+   // temporary branch values must not be allocated on a per-entry basis: the larger tree may
+   // only cost a few more allocations (e.g. for the baskets it reads), far less than one per entry
+   const unsigned long maxExtraAllocs = 1000;
+   const auto extraAllocs = allocsLarge > allocsSmall ? allocsLarge - allocsSmall : 0;
+   if (extraAllocs > maxExtraAllocs)
+      std::cout << "too many extra allocations for " << nLarge - nSmall << " more entries: " << extraAllocs
+                << std::endl;
+   std::cout << "extra allocations within bound: " << (extraAllocs <= maxExtraAllocs ? "yes" : "no") << std::endl;
+
+   return 0;
+}
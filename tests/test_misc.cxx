@@ -5,8 +5,11 @@
 #include "TMath.h"
 #include "TTree.h"
 #include "TRandom3.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 
 using FourVector = ROOT::Math::XYZTVector;
@@ -63,6 +66,12 @@ void FillTree(const char* filename, const char* treeName) {
    return;
 }
 
+// a type that can be cached although it has no default constructor
+struct TNoDefault {
+   explicit TNoDefault(double v) : fV(v) {}
+   double fV;
+};
+
 template<class T>
 void CheckRes(const T& v, const T& ref, const char* msg) {
    if (v!=ref) {
@@ -251,6 +260,342 @@ int main() {
    }
    std::cout << "Count with action pointers which went out of scope: " << *d11c << std::endl;
 
+   // TEST 14: batched mode
+   ROOT::TDataFrame d12(treeName, &f, {"b2"});
+   d12.SetBatchSize(3);
+   auto d12f = d12.Filter([](int b2) { return b2 % 2 == 0; }, {}, "even");
+   auto min_b2_batch = d12f.Min();
+   auto max_b2_batch = d12f.Max();
+   auto mean_b2_batch = d12f.Mean();
+   auto h_b2_batch = d12f.Histo("b2", 64, 0, 400);
+   auto d12t = d12f.AddBranch("b1sq", [](double b1) { return b1 * b1; }, {"b1"})
+                  .Filter([](double b1sq) { return b1sq > 50; }, {"b1sq"}, "large");
+   auto take12 = d12t.Take<double>("b1sq");
+   auto report12 = d12t.Report();
+   CheckRes(*min_b2_batch, 0., "Batched Min");
+   CheckRes(*max_b2_batch, 324., "Batched Max");
+   CheckRes(*mean_b2_batch, 114., "Batched Mean");
+   CheckRes(h_b2_batch->GetEntries(), 10., "Batched Histo");
+   CheckRes(*take12, std::vector<double>({64., 100., 144., 196., 256., 324.}), "Batched temporary branch");
+   CheckRes(report12->At("large").GetAll(), 10ULL, "Batched report");
+   std::cout << "Batched min, max, mean of b2: " << *min_b2_batch << " " << *max_b2_batch << " "
+             << *mean_b2_batch << std::endl;
+   std::cout << "Batched filter after a temporary branch: " << take12->size() << " of "
+             << report12->At("large").GetAll() << std::endl;
+
+   // TEST 15: kernel mode
+   ROOT::TDataFrame d13(treeName, &f, {"b2"});
+   d13.SetKernelMode();
+   d13.SetBatchSize(7);
+   auto d13f = d13.Filter([](int b2) { return b2 > 10; });
+   auto d13ff1 = d13f.AddBranch("b2half", [](int b2) { return b2 / 2; })
+                     .Filter([](int b2half) { return b2half % 3 == 0; }, {"b2half"});
+   auto d13ff2 = d13f.Filter([](double b1) { return b1 < 15; }, {"b1"});
+   auto c13 = d13.Count();
+   auto c13f = d13f.Count();
+   auto c13ff1 = d13ff1.Count();
+   auto max13ff1 = d13ff1.Max();
+   auto c13ff2 = d13ff2.Count();
+   CheckRes(*c13, 20U, "Kernel mode, no filter");
+   CheckRes(*c13f, 16U, "Kernel mode, one filter");
+   CheckRes(*c13ff1, 9U, "Kernel mode, filter after temporary branch");
+   CheckRes(*max13ff1, 361., "Kernel mode, max after temporary branch");
+   CheckRes(*c13ff2, 11U, "Kernel mode, forked filter");
+   std::cout << "Kernel mode counts: " << *c13 << " " << *c13f << " " << *c13ff1 << " " << *c13ff2 << std::endl;
+
+   // TEST 16: ranges and early termination of the event loop
+   ROOT::TDataFrame d14(treeName, &f, {"b1"});
+   auto d14r = d14.Filter([](double b1) { return b1 > 4; }).Range(2, 10, 3);
+   auto c14r = d14r.Count();
+   auto min14r = d14r.Min();
+   auto max14r = d14r.Max();
+   auto c14 = d14.Range(5).Count();
+   CheckRes(*c14r, 3U, "Range with stride after a filter");
+   CheckRes(*min14r, 7., "Min after a range");
+   CheckRes(*max14r, 13., "Max after a range");
+   CheckRes(*c14, 5U, "Range of the first entries");
+   const auto entries14 = d14.GetEntriesPerSlot()[0];
+   CheckRes(entries14, 15ULL, "Early termination of the event loop");
+   std::cout << "Ranges: " << *c14r << " " << *min14r << " " << *max14r << " " << *c14 << ", entries processed "
+             << entries14 << std::endl;
+   // range bounds are 64-bit entry numbers: this one must not be truncated to 5
+   auto c14big = d14.Range((1ULL << 32) + 5).Count();
+   CheckRes(*c14big, 20U, "Range with a bound above 2^32");
+
+   // TEST 17: snapshot of real and temporary branches
+   ROOT::TDataFrame d15(treeName, &f, {"b1"});
+   auto d15s = d15.Filter([](double b1) { return b1 > 9; })
+                  .AddBranch("b1b2", [](double b1, int b2) { return b1 + b2; }, {"b1", "b2"})
+                  .Snapshot<double, double>("mySnapshotTree", "mySnapshotFile.root", {"b1", "b1b2"});
+   auto c15 = d15s.Count();
+   auto min15 = d15s.Min("b1");
+   auto max15 = d15s.Max("b1b2");
+   CheckRes(*c15, 10U, "Snapshot, count");
+   CheckRes(*min15, 10., "Snapshot, min of a real branch");
+   CheckRes(*max15, 380., "Snapshot, max of a temporary branch");
+   TFile f15("mySnapshotFile.root");
+   auto t15 = static_cast<TTree *>(f15.Get("mySnapshotTree"));
+   CheckRes(t15->GetListOfBranches()->GetEntries(), 2, "Snapshot, only the selected branches are written");
+   std::cout << "Snapshot: " << *c15 << " " << *min15 << " " << *max15 << std::endl;
+   // no entry passes the selection: the tree is written anyway, with all its branches
+   ROOT::TDataFrame d15e(treeName, &f, {"b1"});
+   auto d15es = d15e.Filter([](double b1) { return b1 < 0; })
+                   .AddBranch("b1b2", [](double b1, int b2) { return b1 + b2; }, {"b1", "b2"})
+                   .Snapshot<double, double>("mySnapshotTree", "mySnapshotFileEmpty.root", {"b1", "b1b2"});
+   auto c15e = d15es.Count();
+   CheckRes(*c15e, 0U, "Snapshot of no entries, count");
+   TFile f15e("mySnapshotFileEmpty.root");
+   auto t15e = static_cast<TTree *>(f15e.Get("mySnapshotTree"));
+   CheckRes(t15e->GetEntries(), 0LL, "Snapshot of no entries, entries");
+   CheckRes(t15e->GetListOfBranches()->GetEntries(), 2, "Snapshot of no entries, branches");
+   std::cout << "Snapshot of no entries: " << t15e->GetEntries() << " entries, "
+             << t15e->GetListOfBranches()->GetEntries() << " branches" << std::endl;
+
+   // TEST 18: cache of real and temporary branches
+   ROOT::TDataFrame d16(treeName, &f, {"b1"});
+   auto d16c = d16.Filter([](double b1) { return b1 > 9; })
+                  .AddBranch("b1b2", [](double b1, int b2) { return b1 + b2; }, {"b1", "b2"})
+                  .Cache<double, double>({"b1", "b1b2"});
+   auto c16 = d16c.Count();
+   auto max16 = d16c.Max("b1b2");
+   auto c16f = d16c.Filter([](double b1) { return b1 < 15; }, {"b1"}).Count();
+   CheckRes(*c16, 10U, "Cache, count");
+   CheckRes(*max16, 380., "Cache, max of a temporary branch");
+   CheckRes(*c16f, 5U, "Cache, filter on a cached column");
+   auto mean16 = d16c.Mean("b1");
+   CheckRes(*mean16, 14.5, "Cache, second event loop on the cached columns");
+   std::cout << "Cache: " << *c16 << " " << *max16 << " " << *c16f << " " << *mean16 << std::endl;
+   auto d16nd = d16.Filter([](double b1) { return b1 > 9; })
+                   .AddBranch("nd", [](double b1) { return TNoDefault(b1); })
+                   .Cache<TNoDefault>({"nd"});
+   auto c16nd = d16nd.Filter([](const TNoDefault &nd) { return nd.fV < 15; }, {"nd"}).Count();
+   CheckRes(*c16nd, 5U, "Cache of a type without default constructor");
+   auto nd16 = d16.AddBranch("nd", [](double b1) { return TNoDefault(b1); });
+   auto take16nd = nd16.Take<TNoDefault, std::vector<TNoDefault>>("nd");
+   auto chunks16nd = nd16.Take<TNoDefault, ROOT::TChunkedVector<TNoDefault>>("nd");
+   CheckRes(take16nd->size(), 20UL, "Take of a type without default constructor");
+   CheckRes(chunks16nd->Flatten().back().fV, 19., "Flattened take of a type without default constructor");
+
+   // TEST 19: data frames sharing their event loop
+   ROOT::TDataFrame d17a(treeName, &f, {"b1"});
+   ROOT::TDataFrame d17b(treeName, &f, {"b2"});
+   d17a.ShareEventLoop(d17b);
+   auto c17a = d17a.Filter([](double b1) { return b1 > 4; }).Count();
+   auto max17b = d17b.Max();
+   CheckRes(*max17b, 361., "Shared event loop, action of the triggering data frame");
+   CheckRes(d17a.GetEntriesPerSlot()[0], 20ULL, "Shared event loop, entries read by the other data frame");
+   CheckRes(*c17a, 15U, "Shared event loop, action of the other data frame");
+   std::cout << "Shared event loop: " << *c17a << " " << *max17b << std::endl;
+
+   // TEST 20: read set of the booked actions
+   ROOT::TDataFrame d18(treeName, &f, {"b1"});
+   auto d18f = d18.Filter([](int b2) { return b2 > 10; }, {"b2"});
+   d18.Filter([](const std::vector<double> &dv) { return dv.size() > 1; }, {"dv"}); // no action: not read
+   auto max18 = d18f.AddBranch("b1half", [](double b1) { return b1 / 2; }).Max("b1half");
+   const auto readSet18 = d18.GetReadSet();
+   CheckRes(readSet18, ROOT::BranchNames({"b1", "b2"}), "Read set");
+   CheckRes(*max18, 9.5, "Max after restricting the read set");
+   std::cout << "Read set:";
+   for (auto &b : readSet18) std::cout << " " << b;
+   std::cout << std::endl;
+   // the cache of a tree that belongs to the user is left as it was found
+   auto t18 = static_cast<TTree *>(f.Get(treeName));
+   CheckRes(t18->GetCacheSize(), 0LL, "No cache left behind in the user tree");
+   t18->SetCacheSize(1000000);
+   ROOT::TDataFrame d18c(treeName, &f, {"b1"});
+   auto max18c = d18c.Max();
+   CheckRes(*max18c, 19., "Max with a cache set up by the user");
+   CheckRes(t18->GetCacheSize(), 1000000LL, "Cache size set by the user");
+   t18->SetCacheSize(0);
+
+   // TEST 21: reordering of commutative filters
+   ROOT::TDataFrame d19(treeName, &f, {"b1"});
+   d19.SetFilterReordering();
+   auto d19f = d19.Filter([](double b1) { return b1 > 2; })
+                  .Filter([](int b2) { return b2 % 2 == 0; }, {"b2"})
+                  .Filter([](double b1) { return b1 < 15; });
+   auto count19 = d19f.Count();
+   auto mean19 = d19f.Mean();
+   CheckRes(*count19, 6U, "Count with reordered filters");
+   CheckRes(*mean19, 9., "Mean with reordered filters");
+   std::cout << "Reordered filters: " << *count19 << " " << *mean19 << std::endl;
+
+   // TEST 22: cut-flow report
+   ROOT::TDataFrame d20(treeName, &f, {"b1"});
+   auto report20 = d20.Filter([](double b1) { return b1 > 4; }, {}, "b1cut")
+                      .Filter([](int b2) { return b2 < 100; }, {"b2"}, "b2cut")
+                      .Report();
+   CheckRes(report20->At("b1cut").GetAccepted(), 15ULL, "Report, first filter");
+   CheckRes(report20->At("b2cut").GetAll(), 15ULL, "Report, second filter");
+   std::cout << "Report:";
+   for (auto &cut : *report20)
+      std::cout << " " << cut.GetName() << " " << cut.GetAll() << " " << cut.GetAccepted() << " "
+                << cut.GetCumulativeEff();
+   std::cout << std::endl;
+
+   // TEST 23: profiling
+   ROOT::TDataFrame d21(treeName, &f, {"b1"});
+   d21.SetProfiling();
+   auto count21 = d21.Filter([](double b1) { return b1 > 4; }, {}, "b1cut")
+                     .AddBranch("b1sq", [](double b1) { return b1 * b1; })
+                     .Count();
+   CheckRes(*count21, 15U, "Count with profiling");
+   const auto &profile21 = d21.GetProfile();
+   CheckRes(profile21.GetReaderLoad().GetNCalls(), 20ULL, "Profiled reader loads");
+   std::cout << "Profile:";
+   for (auto &node : profile21.GetNodes()) std::cout << " " << node.GetKind() << " " << node.GetNCalls();
+   std::cout << std::endl;
+
+   // TEST 24: partial results
+   ROOT::TDataFrame d22(treeName, &f, {"b1"});
+   auto count22 = d22.Filter([](double b1) { return b1 > 4; }).Count();
+   std::vector<unsigned int> partials22;
+   std::vector<ULong64_t> nEntries22;
+   count22.OnPartialResult(5, [&](const unsigned int &c, const ROOT::TLoopProgress &progress) {
+      partials22.emplace_back(c);
+      nEntries22.emplace_back(progress.fNEntries);
+   });
+   CheckRes(*count22, 15U, "Count with partial results");
+   CheckRes(nEntries22, std::vector<ULong64_t>({5, 10, 15, 20}), "Entries of the partial results");
+   std::cout << "Partial results:";
+   for (auto c : partials22) std::cout << " " << c;
+   std::cout << std::endl;
+   // the maximum of negative values is negative, in partial results too
+   auto max22 = d22.AddBranch("minusb1", [](double b1) { return -b1 - 1; }).Max("minusb1");
+   std::vector<double> partialMaxs22;
+   max22.OnPartialResult(5, [&](const double &m, const ROOT::TLoopProgress &) { partialMaxs22.emplace_back(m); });
+   CheckRes(*max22, -1., "Max of negative values");
+   CheckRes(partialMaxs22, std::vector<double>({-1., -1., -1., -1.}), "Partial maxima of negative values");
+
+   // TEST 25: fill of collections with fixed-width bins, as TH1::Fill would
+   ROOT::TDataFrame d23(treeName, &f, {"dv"});
+   auto h23 = d23.Histo("dv", TH1F("h23", "h23", 16, -2., 14.));
+   TH1F ref23("ref23", "ref23", 16, -2., 14.);
+   d23.Foreach([&ref23](const std::vector<double> &dv) { for (auto v : dv) ref23.Fill(v); });
+   for (int bin = 0; bin <= 17; ++bin)
+      CheckRes(h23->GetBinContent(bin), ref23.GetBinContent(bin), "Bin content of collections");
+   CheckRes(h23->GetEntries(), ref23.GetEntries(), "Entries of collections");
+   CheckRes(h23->GetMean(), ref23.GetMean(), "Mean of collections");
+   std::cout << "Collections fill: " << h23->GetEntries() << " " << h23->GetMean() << " " << h23->GetBinContent(17)
+             << std::endl;
+   // an empty collection cannot be paired with a non-empty one
+   ROOT::TDataFrame d23e(treeName, &f, {"dv"});
+   using Doubles_t = std::vector<double>;
+   auto h2Empty23 = d23e.AddBranch("empty", [](const Doubles_t &) { return Doubles_t(); })
+                       .Histo2D<Doubles_t, Doubles_t>("empty", "dv", TH2F("h2e23", "h2e23", 4, 0., 4., 4, 0., 4.));
+   auto sizeMismatch23 = false;
+   try {
+      *h2Empty23;
+   } catch (const std::runtime_error &) {
+      sizeMismatch23 = true;
+   }
+   CheckRes(sizeMismatch23, true, "Fill with an empty and a non-empty collection");
+
+   // TEST 26: reductions and aggregations
+   ROOT::TDataFrame d24(treeName, &f, {"b1"});
+   auto sum24 = d24.Reduce([](double a, double b) { return a + b; });
+   auto max24 = d24.Filter([](double b1) { return b1 < 10; }).Reduce([](double a, double b) { return a > b ? a : b; }, "b1", -1.);
+   auto sizes24 = d24.Aggregate([]() { return std::vector<unsigned int>(); },
+                                [](std::vector<unsigned int> &acc, const std::vector<double> &dv) { acc.emplace_back(dv.size()); },
+                                [](std::vector<unsigned int> &acc, const std::vector<unsigned int> &other) {
+                                   acc.insert(acc.end(), other.begin(), other.end());
+                                },
+                                "dv");
+   CheckRes(sizes24->size(), 20UL, "Aggregate of collections");
+   std::cout << "Reduce and aggregate: " << *sum24 << " " << *max24 << " " << sizes24->size() << std::endl;
+
+   // TEST 27: statistics in one pass
+   ROOT::TDataFrame d25(treeName, &f, {"b1"});
+   auto stats25 = d25.Stats();
+   auto statsDv25 = d25.Stats("dv");
+   CheckRes(stats25->GetN(), 20ULL, "Stats count");
+   CheckRes(stats25->GetMean(), *d25.Mean(), "Stats mean");
+   CheckRes(statsDv25->GetN(), 290ULL, "Stats count of collections");
+   CheckRes(statsDv25->GetMax(), *d25.Max("dv"), "Stats maximum of collections");
+   // the types of the branches are guessed for quantiles too
+   CheckRes(*d25.Quantiles("b2", {0., 1.}), std::vector<double>({0., 361.}), "Quantiles of an int branch");
+   CheckRes(*d25.Quantiles("dv", {0., 1.}), std::vector<double>({-1., 19.}), "Quantiles of collections");
+   std::cout << "Stats: " << stats25->GetSum() << " " << stats25->GetMean() << " " << stats25->GetVariance() << " "
+             << stats25->GetMin() << " " << stats25->GetMax() << " " << statsDv25->GetMean() << " "
+             << statsDv25->GetStdDev() << std::endl;
+
+   // TEST 28: variable-size C-style arrays, read without copies
+   {
+      TFile af("test_misc_arrays.root", "RECREATE");
+      TTree at("arrays", "arrays");
+      int n;
+      float x[3];
+      at.Branch("n", &n, "n/I");
+      at.Branch("x", x, "x[n]/F");
+      for (int i = 0; i < 20; ++i) {
+         n = i % 4;
+         for (int j = 0; j < n; ++j) x[j] = i + j;
+         at.Fill();
+      }
+      at.Write();
+   }
+   TFile af("test_misc_arrays.root");
+   ROOT::TDataFrame d26("arrays", &af);
+   using FloatArray_t = ROOT::TArrayBranch<float>;
+   auto count26 = d26.Filter([](const FloatArray_t &x) { return x.size() > 1 && x[1] > 10; }, {"x"}).Count();
+   auto sizes26 = d26.AddBranch("nx", [](const FloatArray_t &x) { return (int)x.size(); }, {"x"})
+                     .Reduce([](int a, int b) { return a + b; }, "nx");
+   auto max26 = d26.Max("x");
+   auto mean26 = d26.Mean<FloatArray_t>("x");
+   auto h26 = d26.Histo("x", 22, 0., 22.);
+   CheckRes(h26->GetEntries(), double(*sizes26), "Histo of arrays");
+   CheckRes(*d26.Quantiles("x", {0., 1.}), std::vector<double>({1., 21.}), "Quantiles of arrays");
+   std::cout << "Arrays: " << *count26 << " " << *sizes26 << " " << *max26 << " " << *mean26 << std::endl;
+
+   // TEST 29: histograms with automatic limits, filled with more values than their buffers can hold
+   ROOT::TDataFrame d27(treeName, &f, {"b1"});
+   auto getValues27 = [](double b1) {
+      // the values of each entry span a wider range than the ones of the entries before
+      const auto range = static_cast<int>(30 * std::pow(2., b1 / 2));
+      std::vector<double> vs(350000);
+      for (int j = 0; j < 350000; ++j) vs[j] = (j * 7919LL) % (2 * range + 1) - range;
+      return vs;
+   };
+   auto h27 = d27.AddBranch("values", getValues27).Histo("values");
+   std::vector<double> values27;
+   for (int b1 = 0; b1 < 20; ++b1) {
+      const auto vs = getValues27(b1);
+      values27.insert(values27.end(), vs.begin(), vs.end());
+   }
+   const auto xaxis27 = h27->GetXaxis();
+   TH1F ref27("ref27", "ref27", h27->GetNbinsX(), xaxis27->GetXmin(), xaxis27->GetXmax());
+   for (auto v : values27) ref27.Fill(v);
+   CheckRes(h27->GetEntries(), ref27.GetEntries(), "Entries beyond the buffers");
+   CheckRes(h27->GetMean(), ref27.GetMean(), "Mean beyond the buffers");
+   CheckRes(h27->GetRMS(), ref27.GetRMS(), "RMS beyond the buffers");
+   // values counted in fine bins are filled within 1/4096 of the range of the values from their original position
+   std::sort(values27.begin(), values27.end());
+   const auto tol27 = (values27.back() - values27.front()) / 4096;
+   auto countIn27 = [&values27](double low, double up) {
+      return double(std::lower_bound(values27.begin(), values27.end(), up) -
+                    std::lower_bound(values27.begin(), values27.end(), low));
+   };
+   auto binsOk27 = true;
+   for (int bin = 1; bin <= h27->GetNbinsX(); ++bin) {
+      const auto low = xaxis27->GetBinLowEdge(bin);
+      const auto up = xaxis27->GetBinUpEdge(bin);
+      const auto content = h27->GetBinContent(bin);
+      binsOk27 = binsOk27 && content >= countIn27(low + tol27, up - tol27) && content <= countIn27(low - tol27, up + tol27);
+   }
+   CheckRes(binsOk27, true, "Bin contents beyond the buffers");
+   // infinite and nan values end up in the underflow and overflow bins
+   const auto inf27 = std::numeric_limits<double>::infinity();
+   const double special27[] = {1., 2., -inf27, inf27, std::numeric_limits<double>::quiet_NaN(), 3.};
+   ROOT::Internal::Operations::TRebinnableCounts counts27;
+   counts27.Add(special27, 6);
+   TH1F hs27("hs27", "hs27", 4, 0., 4.);
+   counts27.FillHistogram(hs27);
+   std::vector<double> contents27;
+   for (int bin = 0; bin <= 5; ++bin) contents27.emplace_back(hs27.GetBinContent(bin));
+   CheckRes(contents27, std::vector<double>({1., 0., 1., 1., 1., 2.}), "Underflow and overflow of fine bins");
+   CheckRes(hs27.GetEntries(), 6., "Entries of fine bins");
+   std::cout << "Histogram beyond the buffers: " << values27.size() << " " << h27->GetMean() << std::endl;
+
    return 0;
 }
 